@@ -0,0 +1,4 @@
+/* ADAPT.H - h-adaptive mesh refinement */
+
+element *adapt_mesh (const weeks_ctx *, element *, element, int *, int *,
+                     conductor *, int, double, MAT **);
@@ -0,0 +1,21 @@
+/* BORDER.H - growing a factored element matrix by new conductors */
+
+typedef struct {
+  element *e;       /* all elements, the first m factored */
+  element e0;
+  int n0, m, N;
+  conductor *cond;
+  double Omega;
+  ZMAT *LU;         /* factorization of Z of the first m elements */
+  PERM *pivot;
+} bordered;
+
+ZMAT *zLUborder (ZMAT *LU, PERM *pivot, const ZMAT *Zb, PERM **pnew);
+bordered *bd_factor (element *e, element e0, int m, int n0,
+                     conductor *cond, int N, double Omega);
+void bd_extend (bordered *bd, int m);
+ZMAT *bd_ports (const bordered *bd, int N, ZMAT *y);
+void bd_free (bordered *bd);
+void incremental (element *e, element e0, int n0, conductor *cond, int N,
+                  const double *freq, int nfreq, sweep_report report,
+                  void *arg);
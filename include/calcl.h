@@ -2,6 +2,17 @@
 
 void calcl (ZMAT *, element *, double, double, element, conductor *, int);
 
+/* Split form of calcl: frequency independent fill + per-frequency assembly */
+void calclp (MAT *, element *, element);
+void calclp_update (MAT *, element *, element, const MAT *, const int *);
+void calclp_rows (MAT *, element *, element, const int *, int);
+void calclp_border (MAT *, element *, element, int, int);
+void calcz (ZMAT *, const MAT *, element *, int, double, element,
+            conductor *, int);
+double calc_r00 (element, double, conductor *);
+double calc_element_loss (element *, double, conductor *, int);
+double lp_image (element *, element *, element);
+
 /* New helper functions */
 double calc_eff_dielectric(double w, double h, double er);
 double calc_dielectric_loss(double er, double tan_delta, 
@@ -0,0 +1,8 @@
+/* CURRENTS.H - element current density export */
+
+typedef struct cur_stream cur_stream;
+
+cur_stream *cur_open (const char *, int, int);
+void cur_write (cur_stream *, const ZMAT *, element *, element, int,
+                conductor *, int, double);
+int cur_close (cur_stream *);
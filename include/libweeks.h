@@ -0,0 +1,27 @@
+/* LIBWEEKS.H - the solver as a library (libweeks.a, libweeks.so)
+ *
+ * Include after zmatrix2.h and weeks.h. A run is set up in a weeks_ctx,
+ * either from weeks_defaults and direct assignment or from a YAML file
+ * with weeks_load, and is solved for the conductors line0..lineN. Runs
+ * with separate contexts may be solved concurrently.
+ */
+
+typedef struct {
+  int N;             /* signal lines, each result is N x N */
+  int n;             /* number of results, in the order solved */
+  double *f;         /* frequency of each result */
+  ZMAT **z;          /* port impedance per metre, smaller for the first
+                        steps of an incremental run (zero padded in R, L) */
+  double *R, *L;     /* n row-major N x N blocks, Ohm/m and H/m */
+} weeks_result;
+
+weeks_ctx *weeks_create (void);
+void weeks_destroy (weeks_ctx *);
+conductor *weeks_read (weeks_ctx *, FILE *, const char *, int *);
+conductor *weeks_load (weeks_ctx *, const char *, int *);
+int weeks_run (weeks_ctx *, conductor *, int,
+               void (*) (ZMAT *, ZMAT *, double, int, void *), void *);
+void weeks_report (ZMAT *, ZMAT *, double, int, void *);
+double weeks_footprint (weeks_ctx *, const conductor *, int);
+weeks_result *weeks_solve (weeks_ctx *, const conductor *, int);
+void weeks_result_free (weeks_result *);
@@ -0,0 +1,25 @@
+/* LOWRANK.H - Woodbury update of a factored element matrix */
+
+typedef struct {
+  MAT *L0;          /* partial inductances of the factored geometry */
+  element *e;       /* its elements */
+  element e0;
+  int M, n0, N;
+  conductor *cond;
+  double Omega;
+  ZMAT *LU;         /* factorization of Z0 */
+  PERM *pivot;
+  int s, *S;        /* elements changed since the factorization */
+  ZMAT *P, *Q;      /* rows: columns of Z0^-1 E_S and Z0^-1 Dc */
+  ZMAT *Ds;         /* rows S of Z - Z0 */
+  ZMAT *C;          /* factorization of I + V' Z0^-1 U */
+  PERM *cpivot;
+  int updates, refactors;
+} lowrank;
+
+lowrank *lr_factor (const MAT *L, element *e, element e0, int n0,
+                    conductor *cond, int N, double Omega);
+int lr_update (lowrank *lr, const MAT *L, element *e, const int *S, int s);
+ZVEC *lr_solve (const lowrank *lr, ZVEC *b, ZVEC *x);
+ZMAT *lr_ports (const lowrank *lr, ZMAT *y);
+void lr_free (lowrank *lr);
@@ -0,0 +1,12 @@
+/* LPCACHE.H - Lp matrices kept between solves */
+
+typedef struct lp_cache lp_cache;
+
+lp_cache *lpc_create (double bytes);
+int lpc_persist (lp_cache *, const char *dir, double bytes);
+MAT *lpc_full (lp_cache *, element *e, element e0, int M);
+void lpc_sym (lp_cache *, symmetry *sym);
+void lpc_release (lp_cache *, MAT *);
+void lpc_stats (lp_cache *, int *hits, int *partial, int *misses,
+                double *bytes);
+void lpc_free (lp_cache *);
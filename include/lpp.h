@@ -1 +1,2 @@
 double Lp (element *, element *);
+double F (double, double, double, double);
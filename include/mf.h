@@ -3,3 +3,59 @@ void *Calloc(size_t, size_t);
 void *Malloc(size_t);
 void *Realloc(void *, size_t);
 size_t get_max_memory (void);
+size_t get_memory (void);
+
+/* Bump allocation for scratch of one phase, freed all at once */
+typedef struct mf_arena mf_arena;
+
+mf_arena *mf_arena_create (size_t);
+void *mf_arena_alloc (mf_arena *, size_t);
+void mf_arena_reset (mf_arena *);
+void mf_arena_free (mf_arena *);
+
+/* Meschach objects made and freed by the including file are counted
+ * in get_memory as well. Include after the Meschach headers.
+ */
+#if defined(MATRIXH) && !defined(MF_C)
+MAT *mf_m_get (int, int);
+MAT *mf_m_resize (MAT *, int, int);
+MAT *mf_m_copy (MAT *, MAT *, u_int, u_int);
+int mf_m_free (MAT *);
+VEC *mf_v_get (int);
+VEC *mf_v_resize (VEC *, int);
+int mf_v_free (VEC *);
+PERM *mf_px_get (int);
+PERM *mf_px_resize (PERM *, int);
+int mf_px_free (PERM *);
+
+#define m_get(m,n)          mf_m_get (m, n)
+#define m_resize(A,m,n)     mf_m_resize (A, m, n)
+#define _m_copy(A,B,i,j)    mf_m_copy (A, B, i, j)
+#define m_free(A)           mf_m_free (A)
+#define v_get(n)            mf_v_get (n)
+#define v_resize(x,n)       mf_v_resize (x, n)
+#define v_free(x)           mf_v_free (x)
+#define px_get(n)           mf_px_get (n)
+#define px_resize(p,n)      mf_px_resize (p, n)
+#define px_free(p)          mf_px_free (p)
+#endif
+
+#if defined(ZMATRIXH) && !defined(MF_C)
+ZMAT *mf_zm_get (int, int);
+ZMAT *mf_zm_resize (ZMAT *, int, int);
+ZMAT *mf_zm_copy (ZMAT *, ZMAT *, u_int, u_int);
+ZMAT *mf_zm_inverse (ZMAT *, ZMAT *);
+int mf_zm_free (ZMAT *);
+ZVEC *mf_zv_get (int);
+ZVEC *mf_zv_resize (ZVEC *, int);
+int mf_zv_free (ZVEC *);
+
+#define zm_get(m,n)         mf_zm_get (m, n)
+#define zm_resize(A,m,n)    mf_zm_resize (A, m, n)
+#define _zm_copy(A,B,i,j)   mf_zm_copy (A, B, i, j)
+#define zm_inverse(A,B)     mf_zm_inverse (A, B)
+#define zm_free(A)          mf_zm_free (A)
+#define zv_get(n)           mf_zv_get (n)
+#define zv_resize(x,n)      mf_zv_resize (x, n)
+#define zv_free(x)          mf_zv_free (x)
+#endif
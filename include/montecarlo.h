@@ -0,0 +1,8 @@
+/* MONTECARLO.H - manufacturing tolerance analysis */
+
+#include <stdint.h>
+
+double uniform01 (uint64_t *);
+
+int monte_carlo (const weeks_ctx *, conductor *, int, const tolerance *, int,
+                  int, unsigned long, const char *, const double *, int);
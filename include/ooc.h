@@ -0,0 +1,5 @@
+/* OOC.H - out-of-core solves */
+
+int ooc_needed (const weeks_ctx *, int);
+int ooc_sweep (const weeks_ctx *, element *, element, int, int, conductor *,
+               int, const double *, int, sweep_report, void *);
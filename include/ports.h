@@ -0,0 +1,4 @@
+/* PORTS.H - port groupings of the conductor admittance */
+
+int port_group_check (const port_group *, int);
+ZMAT *port_group_z (ZMAT *, const port_group *, int, ZMAT *);
@@ -0,0 +1,68 @@
+/* PROF.H - per run timers and counters */
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Phases, timed with the monotonic clock in every thread that works on
+ * the run and summed, so on a sweep they add up to more than the wall
+ * time.
+ */
+#define PROF_PARSE     0   /* getinput */
+#define PROF_MESH      1   /* mesh_conductors */
+#define PROF_FILL      2   /* Lp matrices (calclp and its variants) */
+#define PROF_ASSEMBLE  3   /* Z = R + jwL */
+#define PROF_FACTOR    4   /* LU of Z */
+#define PROF_SOLVE     5   /* substitutions for the port excitations */
+#define PROF_REDUCE    6   /* port sums and N x N inversions */
+#define PROF_NPHASE    7
+
+/* Counters */
+#define PROF_LP        0   /* lp() calls */
+#define PROF_FLOPS     1   /* estimated from the sizes factored and solved */
+#define PROF_IO_READ   2   /* out-of-core bytes read */
+#define PROF_IO_WRITE  3   /* out-of-core bytes written */
+#define PROF_ELEMENTS  4   /* largest mesh, a maximum, not a sum */
+#define PROF_NCOUNT    5
+
+/* Hardware counters of each phase (perf_event_open), with hw_counters.
+ * Cache references and misses are of the last level cache.
+ */
+#define PROF_CYCLES        0
+#define PROF_INSTRUCTIONS  1
+#define PROF_CACHE_REFS    2
+#define PROF_CACHE_MISSES  3
+#define PROF_NHW           4
+#define PROF_LINE         64   /* bytes moved per cache miss */
+
+/* Real flops of an m x m complex LU and of k pairs of triangular
+ * solves with it
+ */
+#define PROF_LU_FLOPS(m)      (8.0/3.0*(double) (m)*(m)*(m))
+#define PROF_SOLVE_FLOPS(m,k) (8.0*(double) (m)*(m)*(k))
+
+typedef struct prof {
+  char deck[256];
+  uint64_t start;                /* prof_now at prof_create */
+  uint64_t ns[PROF_NPHASE];
+  uint64_t calls[PROF_NPHASE];
+  uint64_t count[PROF_NCOUNT];
+  int hw;                        /* count hardware events */
+  uint64_t hw_ns[PROF_NPHASE];   /* time of the phases counted */
+  uint64_t hw_count[PROF_NPHASE][PROF_NHW];
+} prof;
+
+/* lp() calls of this thread not yet added to a profile */
+extern __thread uint64_t prof_lp_calls;
+
+uint64_t prof_now (void);
+prof *prof_create (const char *deck);
+prof *prof_attach (prof *);
+prof *prof_current (void);
+uint64_t prof_begin (void);
+void prof_add (int phase, uint64_t t0);
+void prof_count (int counter, double n);
+void prof_max (int counter, uint64_t n);
+size_t prof_peak_rss (void);
+int prof_write (const prof *, const char *file, int ok);
+void prof_print_hw (FILE *, const prof *);
+void prof_free (prof *);
@@ -0,0 +1,4 @@
+/* PROGRESS.H - progressive coarse-to-fine solves */
+
+int progressive (const weeks_ctx *, conductor *, int, const double *, int,
+                 int, double, sweep_report, void *);
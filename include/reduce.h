@@ -0,0 +1,10 @@
+/* REDUCE.H - reduction of the element system to one port per conductor */
+
+void port_factor (ZMAT *, PERM *);
+ZMAT *port_reduce (ZMAT *, PERM *, int, conductor *, int, ZMAT *);
+ZMAT *port_solutions (ZMAT *, PERM *, int, conductor *, int, ZMAT *);
+ZMAT *port_sum (ZMAT *, int, conductor *, int, ZMAT *);
+ZMAT *port_inverse (ZMAT *, ZMAT *);
+
+/* LU solve from zlufctr.c (same as Meschach zLUsolve) */
+ZVEC *zzLUsolve (ZMAT *, PERM *, ZVEC *, ZVEC *);
@@ -0,0 +1,11 @@
+/* RESCACHE.H - stored port impedances of complete runs */
+
+typedef struct rc_run rc_run;
+
+rc_run *rc_begin (const weeks_ctx *, const conductor *, int,
+                  void (*) (ZMAT *, ZMAT *, double, int, void *), void *);
+int rc_replay (rc_run *);
+void rc_keep (ZMAT *, ZMAT *, double, int, void *);
+void rc_store (rc_run *);
+void rc_end (rc_run *);
+void rc_stats (int *hits, int *misses, int *stored);
@@ -0,0 +1,5 @@
+/* STUDY.H - parametric geometry sweep */
+
+int study_points (const sweep_param *, int, int);
+int study (const weeks_ctx *, conductor *, int, const sweep_param *, int,
+            int, const double *, int, sweep_report, void *);
@@ -0,0 +1,21 @@
+/* SWEEP.H - concurrent frequency sweep over one shared Lp matrix */
+
+/* Called in frequency order from the thread that runs sweep(). The
+ * callback owns z and must free it. y is the conductor admittance z
+ * was inverted from, or ZMNULL where there is none (extrapolated or
+ * stored results); it stays with the caller.
+ */
+typedef void (*sweep_report) (ZMAT *z, ZMAT *y, double f, int N,
+                              void *arg);
+
+int sweep_workers (double shared, double per_worker, int nfreq,
+                   int threads, double budget);
+double sweep_shared (int M);
+double sweep_per_worker (int M);
+void sweep (const weeks_ctx *ctx, const MAT *L, const symmetry *sym,
+            element *e, element e0, int n0, conductor *cond, int N,
+            const double *freq, int nfreq, int workers, sweep_report report,
+            void *arg);
+void sweep_mesh (const weeks_ctx *ctx, element *e, element e0, int M, int n0,
+                 conductor *cond, int N, const double *freq, int nfreq,
+                 sweep_report report, void *arg);
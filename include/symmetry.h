@@ -0,0 +1,22 @@
+/* SYMMETRY.H - even/odd decomposition of mirror symmetric cross-sections */
+
+typedef struct {
+  int np, ns;          /* mirror pairs, elements on the axis */
+  int *a, *b;          /* pair p is element a[p] and its image b[p] */
+  int *s;              /* elements on the axis */
+  double axis;         /* x of the mirror axis */
+  MAT *Le, *Lo;        /* even (np+ns) and odd (np) partial inductances */
+  MAT *Ue, *Uo;        /* port excitations in the even/odd bases */
+  element *e;          /* element list the pairs refer to */
+  element e0;
+  int n0, N;
+  conductor *cond;
+} symmetry;
+
+symmetry *find_symmetry (element *, element, int, int, conductor *, int);
+void sym_fill (symmetry *);
+void sym_assemble (const symmetry *, double, ZMAT *, ZMAT *);
+ZMAT *sym_reduce (const symmetry *, ZMAT *, PERM *, ZMAT *, PERM *, ZMAT *);
+ZMAT *sym_solutions (const symmetry *, ZMAT *, PERM *, ZMAT *, PERM *,
+                     ZMAT *);
+void sym_free (symmetry *);
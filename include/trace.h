@@ -0,0 +1,23 @@
+/* TRACE.H - timeline of phases and tasks per thread (Chrome trace)
+ *
+ * The TRACE_ macros record events only in a build with WEEKS_TRACE
+ * (make TRACE=1) and expand to nothing otherwise.
+ */
+
+#include <stdint.h>
+
+#ifdef WEEKS_TRACE
+#define TRACE_BEGIN(name, value) trace_event ('B', name, value)
+#define TRACE_END(name)          trace_event ('E', name, 0.0)
+#define TRACE_THREAD(name)       trace_thread (name)
+#else
+#define TRACE_BEGIN(name, value) ((void) 0)
+#define TRACE_END(name)          ((void) 0)
+#define TRACE_THREAD(name)       ((void) 0)
+#endif
+
+int trace_start (const char *file);
+int trace_stop (void);
+void trace_event (char ph, const char *name, double value);
+void trace_complete (const char *name, uint64_t t0, uint64_t t1);
+void trace_thread (const char *name);
@@ -11,6 +11,10 @@ typedef struct {
     int nw;                /* number of width divisions */
     int nh;                /* number of height divisions */
     int n;                 /* total number of elements (nw * nh) */
+    int mesh;              /* MESH_DEFAULT, MESH_FIXED, MESH_AUTO or MESH_IMAGE */
+    double shell;          /* meshed surface shell depth, 0 = full section */
+    double gmin, gmax;     /* graded ground column widths, 0 = uniform */
+    double grade;          /* graded column width growth per unit distance */
     
     /* Dielectric properties (new) */
     double er;             /* relative permittivity (dielectric constant) */
@@ -18,13 +22,182 @@ typedef struct {
     double tan_delta;      /* loss tangent (dielectric loss) */
 } conductor;
 
-conductor *getinput (FILE *, int *);
+/* Limits of the settings read by getinput */
+#define MAX_CONDUCTORS 10  /* line0 and the signal lines */
+#define MAX_FREQUENCIES 1024
+
+/* Parametric geometry sweep: one conductor field over a list of values */
+#define MAX_SWEEP_PARAMS 8
+#define MAX_SWEEP_VALUES 256
+#define SWEEP_X 0
+#define SWEEP_Y 1
+#define SWEEP_W 2
+#define SWEEP_H 3
+
+typedef struct {
+    int cond;              /* conductor index, 0 = line0 */
+    int field;             /* SWEEP_X, SWEEP_Y, SWEEP_W or SWEEP_H */
+    int n;                 /* number of values */
+    double v[MAX_SWEEP_VALUES];
+} sweep_param;
+
+/* Monte Carlo manufacturing tolerances on the same fields */
+#define MAX_TOLERANCES 8
+#define DIST_NORMAL  0     /* sigma is the standard deviation */
+#define DIST_UNIFORM 1     /* sigma is the half width */
+
+typedef struct {
+    int cond;              /* conductor index, -1 = every signal line */
+    int field;             /* SWEEP_X, SWEEP_Y, SWEEP_W or SWEEP_H */
+    int dist;              /* DIST_NORMAL or DIST_UNIFORM */
+    double sigma;
+} tolerance;
+
+/* Port groupings evaluated on the same solution: each conductor is in
+ * one port, tied to the reference or left floating (no net current)
+ */
+#define MAX_PORT_GROUPS 8
+#define PORT_REFERENCE  0
+#define PORT_FLOATING  -1
+
+typedef struct {
+    char name[32];
+    int nport;             /* number of ports */
+    int port[MAX_CONDUCTORS]; /* 1..nport, PORT_REFERENCE or PORT_FLOATING */
+} port_group;
+
+/* Element current density export */
+#define CURRENT_CSV    0
+#define CURRENT_BINARY 1
+
+/* Out-of-core solves (weeks_ctx.out_of_core) */
+#define OOC_OFF  0         /* always in memory */
+#define OOC_AUTO 1         /* on disk when Z and L exceed memory_budget */
+#define OOC_ON   2         /* always on disk */
 
 typedef struct {
     double x1, x2, y1, y2;
 } element;
 
-element *build_elements (int, int, conductor *, element *);
+/* Mesh modes (conductor.mesh and weeks_ctx.mesh) */
+#define MESH_DEFAULT  -1   /* conductor follows weeks_ctx.mesh */
+#define MESH_FIXED     0   /* nw, nh and b as given in the input */
+#define MESH_AUTO      1   /* nw, nh and b from the skin depth */
+#define MESH_IMAGE     2   /* line0 only: ideal ground, not meshed */
+
+/* Ground plane meshes (weeks_ctx.ground_mesh) */
+#define GROUND_UNIFORM 0   /* nw equal columns as given in the input */
+#define GROUND_GRADED  1   /* columns growing away from the signal lines */
+#define GROUND_IMAGE   2   /* ideal infinite ground by the image method */
+
+/* With an ideal ground the reference e0 is the ground surface: a
+ * zero height strip at y = e0.y1 instead of a line0 element.
+ */
+#define IMAGE_GROUND(e0) ((e0).y2 <= (e0).y1)
+
+/* Surface shell modes (weeks_ctx.shell) */
+#define SHELL_OFF      0   /* always mesh the full cross-section */
+#define SHELL_AUTO     1   /* shell when all frequencies >= shell_frequency */
+#define SHELL_ON       2   /* always mesh only the surface shell */
+
+/* Settings of one run as read by getinput, and the state it keeps
+ * while solving. Runs with separate contexts may go on concurrently in
+ * one process. Besides an Lp cache the caller hands to several of
+ * them, they only share process wide bookkeeping: the allocation
+ * statistics (mf.c) and the result store counters (rescache.c) under
+ * locks, and the trace buffer list (trace.c) and the hardware counter
+ * fallback (prof.c) updated atomically.
+ */
+struct cur_stream;
+struct prof;
+
+typedef struct weeks_ctx {
+    double frequency;
+    double frequencies[MAX_FREQUENCIES];
+    int nfreq;             /* 0 = single point at frequency */
+    int threads;           /* 0 = number of online CPUs */
+    double memory_budget;  /* bytes, 0 = half of physical memory */
+    int mesh;              /* default for conductors without 'mesh' */
+
+    /* Adaptive refinement */
+    int adapt;
+    double adapt_tolerance;
+    double adapt_threshold;
+    int adapt_iterations;
+
+    /* Progressive coarse-to-fine solves, levels 0 or 1 = off */
+    int progressive;
+    double progressive_tolerance;
+
+    /* Surface shell meshing */
+    int shell;
+    double shell_frequency;
+    double shell_depth;
+    int shell_check;
+
+    int symmetry;          /* even/odd decomposition of mirror meshes */
+    int incremental;       /* line1 first, border in the other conductors */
+
+    /* Parametric geometry sweep */
+    sweep_param sweep[MAX_SWEEP_PARAMS];
+    int nsweep;
+    int sweep_zip;
+
+    /* Monte Carlo tolerance analysis */
+    tolerance tol[MAX_TOLERANCES];
+    int ntol;
+    int samples;
+    unsigned long seed;
+    char samples_file[256];
+
+    /* Port groupings printed with every result */
+    port_group groups[MAX_PORT_GROUPS];
+    int ngroups;
+
+    /* Element current density export, off without a file */
+    char current_file[256];
+    int current_format;
+    struct cur_stream *cur;   /* open export while solving */
+
+    FILE *out;             /* result listing, stdout by default */
+    struct lp_cache *lpc;  /* Lp of earlier meshes (lpcache.c) or NULL */
+
+    /* Lp matrices kept on disk between runs, off without a directory */
+    char lp_cache[256];
+    double lp_cache_size;  /* bytes, 0 = unlimited */
+
+    /* Stored results of earlier runs (rescache.c), off without a directory */
+    char result_cache[256];
+    int result_bypass;     /* solve and store even if stored before */
+
+    /* Timings and counters of each run (prof.c), off without a file */
+    char profile_file[256];
+    struct prof *prof;     /* of the run being read or solved */
+    int hw_counters;       /* hardware counters of each phase as well */
+
+    /* Out-of-core solves */
+    int out_of_core;
+    char ooc_dir[256];
+    int ooc_panel;         /* 0 = from memory_budget */
+
+    /* Ground plane mesh, 0 = derive from the uniform mesh */
+    int ground_mesh;
+    int ground_check;
+    double ground_min;
+    double ground_max;
+    double ground_grade;
+} weeks_ctx;
+
+void weeks_defaults (weeks_ctx *);
+conductor *getinput (FILE *, weeks_ctx *, int *);
+const char *field_name (int);
+
+element *build_elements (int, int, conductor *, element *, const double *);
+element *mesh_conductors (int, conductor *, element *, int *, int *);
+void auto_mesh (const weeks_ctx *, int, conductor *, double);
+void shell_mesh (const weeks_ctx *, int, conductor *, double);
+void ground_mesh (const weeks_ctx *, int, conductor *);
+double skin_depth (double);
 double lp (element *, element *);
 
 /* New functions for dielectric calculations */
@@ -32,6 +205,9 @@ double calc_eff_dielectric(double w, double h, double er);
 double calc_dielectric_loss(double er, double tan_delta, 
                             double Omega, double w, double h);
 
+#define SIGMA_COPPER  58e6     /* Copper conductivity S/m */
+#define MU0           (4e-7*3.141592653589793116)
+
 /* Common dielectric materials (for reference) */
 #define ER_AIR         1.0
 #define ER_FR4         4.4      /* Typical FR4 at low frequencies */
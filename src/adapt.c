@@ -0,0 +1,236 @@
+/* adapt.c - h-adaptive mesh refinement
+ *
+ * After each solve the element current density of every port solution
+ * is compared across the edges that neighbouring elements of the same
+ * conductor share. Elements next to a jump larger than
+ * the adapt_tolerance setting (relative to the largest density on that
+ * conductor) are split in two across their longer side, and the system
+ * is solved again. Lp entries between unchanged elements are copied
+ * from the previous pass. The loop ends when the port R and L matrices
+ * change by less than adapt_threshold, when nothing is split or after
+ * adapt_iterations passes.
+ *
+ * The reference element e0 is never split.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "adapt.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+/* 1 if a and b share a piece of an edge */
+static int touching (const element *a, const element *b)
+{
+  double tol;
+
+  tol = 1e-9*fmin (fmin (a->x2-a->x1, a->y2-a->y1),
+                   fmin (b->x2-b->x1, b->y2-b->y1));
+  if (fabs (a->x2-b->x1) < tol || fabs (b->x2-a->x1) < tol)
+    return fmin (a->y2, b->y2)-fmax (a->y1, b->y1) > tol;
+  if (fabs (a->y2-b->y1) < tol || fabs (b->y2-a->y1) < tol)
+    return fmin (a->x2, b->x2)-fmax (a->x1, b->x1) > tol;
+  return 0;
+}
+
+/* Current density of element i in port solution k */
+static double density (const ZMAT *X, const element *e, int i, int k)
+{
+  return zabs (X->me[i][k])/((e[i].x2-e[i].x1)*(e[i].y2-e[i].y1));
+}
+
+/* Mark elements of the block [first,last) next to a large jump */
+static int mark_block (const element *e, int first, int last,
+                       const ZMAT *X, double tol, char *split)
+{
+  int i, j, k, n;
+  double jmax, d;
+
+  n = 0;
+  for (k=0; k<X->n; k++)
+    {
+      jmax = 0.0;
+      for (i=first; i<last; i++)
+        if (density (X, e, i, k) > jmax)
+          jmax = density (X, e, i, k);
+      if (jmax == 0.0)
+        continue;
+
+      for (i=first; i<last; i++)
+        for (j=i+1; j<last; j++)
+          {
+            if (split[i] && split[j])
+              continue;
+            if (!touching (&e[i], &e[j]))
+              continue;
+            d = fabs (density (X, e, i, k)-density (X, e, j, k))/jmax;
+            if (d > tol)
+              {
+                n += !split[i] + !split[j];
+                split[i] = split[j] = 1;
+              }
+          }
+    }
+  return n;
+}
+
+/* Copy e to a new list with the marked elements split in two. old[i]
+ * is the index in e of new element i if it is unchanged, otherwise -1.
+ * Elements of a conductor stay contiguous; n0 and test[].n are updated.
+ */
+static element *split_elements (element *e, int M, int *n0,
+                                conductor *test, int N, const char *split,
+                                int nsplit, int **old)
+{
+  element *en;
+  int i, c, m, first, last, count;
+  double mid;
+
+  en = (element *) Calloc (M+nsplit, sizeof (element));
+  *old = (int *) Malloc ((M+nsplit)*sizeof (int));
+  m = 0;
+  first = 0;
+  for (c=0; c<=N; c++)
+    {
+      last = c == 0 ? *n0 : first+test[c].n;
+      count = 0;
+      for (i=first; i<last; i++)
+        {
+          if (!split[i])
+            {
+              en[m] = e[i];
+              (*old)[m++] = i;
+              count++;
+              continue;
+            }
+          en[m] = en[m+1] = e[i];
+          if (e[i].x2-e[i].x1 >= e[i].y2-e[i].y1)
+            {
+              mid = 0.5*(e[i].x1+e[i].x2);
+              en[m].x2 = en[m+1].x1 = mid;
+            }
+          else
+            {
+              mid = 0.5*(e[i].y1+e[i].y2);
+              en[m].y2 = en[m+1].y1 = mid;
+            }
+          (*old)[m++] = -1;
+          (*old)[m++] = -1;
+          count += 2;
+        }
+      if (c == 0)
+        *n0 = count;
+      else
+        test[c].n = count;
+      first = last;
+    }
+  return en;
+}
+
+/* Largest change of the port R and L between two passes, relative to
+ * the diagonal entry of the same row.
+ */
+static double port_change (const ZMAT *z, const ZMAT *zp)
+{
+  int i, j;
+  double d, c;
+
+  c = 0.0;
+  for (i=0; i<z->m; i++)
+    for (j=0; j<z->n; j++)
+      {
+        d = fabs (z->me[i][j].re-zp->me[i][j].re)/fabs (z->me[i][i].re);
+        if (d > c)
+          c = d;
+        d = fabs (z->me[i][j].im-zp->me[i][j].im)/fabs (z->me[i][i].im);
+        if (d > c)
+          c = d;
+      }
+  return c;
+}
+
+/* Refine e (M elements, n0 of them in the ground plane) at frequency f.
+ * *L must hold the calclp matrix of e and is replaced by that of the
+ * refined mesh. Returns the refined element list; e is freed.
+ */
+element *adapt_mesh (const weeks_ctx *ctx, element *e, element e0, int *M,
+                     int *n0, conductor *test, int N, double f, MAT **L)
+{
+  ZMAT *Z, *X, *y, *z, *zp;
+  PERM *pivot;
+  MAT *Ln;
+  element *en;
+  char *split;
+  int *old;
+  int it, i, first, nsplit;
+  double Omega, change;
+
+  Omega = 2.0*PI*f;
+  zp = ZMNULL;
+  fprintf (stderr, "\n\nAdaptive refinement at %.2e Hz:", f);
+
+  for (it=0; ; it++)
+    {
+      Z = zm_get (*M, *M);
+      pivot = px_get (*M);
+      calcz (Z, *L, e, *n0, Omega, e0, test, N);
+      port_factor (Z, pivot);
+      X = port_solutions (Z, pivot, *n0, test, N, ZMNULL);
+      PX_FREE (pivot);
+      ZM_FREE (Z);
+      y = port_sum (X, *n0, test, N, ZMNULL);
+      z = port_inverse (y, y);
+
+      change = zp == ZMNULL ? HUGE_VAL : port_change (z, zp);
+      fprintf (stderr, "\n  Pass %d: M=%d", it, *M);
+      if (zp != ZMNULL)
+        fprintf (stderr, ", max R/L change %.3e", change);
+      ZM_FREE (zp);
+      zp = z;
+      if (change < ctx->adapt_threshold || it >= ctx->adapt_iterations)
+        {
+          ZM_FREE (X);
+          break;
+        }
+
+      split = (char *) Calloc (*M, sizeof (char));
+      nsplit = mark_block (e, 0, *n0, X, ctx->adapt_tolerance, split);
+      first = *n0;
+      for (i=1; i<=N; i++)
+        {
+          nsplit += mark_block (e, first, first+test[i].n, X,
+                                ctx->adapt_tolerance, split);
+          first += test[i].n;
+        }
+      ZM_FREE (X);
+      fprintf (stderr, ", splitting %d elements", nsplit);
+      if (nsplit == 0)
+        {
+          Free (split);
+          break;
+        }
+
+      en = split_elements (e, *M, n0, test, N, split, nsplit, &old);
+      Ln = m_get (*M+nsplit, *M+nsplit);
+      calclp_update (Ln, en, e0, *L, old);
+      M_FREE (*L);
+      *L = Ln;
+      Free (old);
+      Free (split);
+      Free (e);
+      e = en;
+      *M += nsplit;
+    }
+
+  ZM_FREE (zp);
+  fprintf (stderr, "\n  Final mesh: %d elements", *M);
+  return e;
+}
@@ -0,0 +1,340 @@
+/* batch.c - many input decks solved in one process
+ *
+ *   weeks-batch [-n] [-H] [-j workers] [-m bytes] [-o dir] [-f manifest]
+ *               [-p profile.json] [-t trace.json] deck.yaml ...
+ *
+ * Every deck gets its own weeks_ctx and is run by one of a pool of
+ * worker threads. Its result listing goes to <deck>.out next to the
+ * deck, or to <dir>/<deck>.out with -o. A manifest has one deck per
+ * line, optionally followed by the name of its listing; '#' starts a
+ * comment.
+ *
+ * Decks are admitted in order while the sum of their memory estimates
+ * (weeks_footprint) fits the budget, -m or half of the physical memory
+ * by default. A deck that needs more than the budget waits until it
+ * can run on its own, and then goes out of core if its settings allow.
+ * A deck without its own 'threads' setting is solved with one sweep
+ * worker, so the pool size sets the parallelism.
+ *
+ * Decks with a result_cache reuse stored results; -n solves them all
+ * again, as weeks -n does. With -p every deck without its own
+ * profile_file appends the profile of its run to one file, and -t
+ * writes a Chrome trace of the whole batch (see trace.c). -H lists the
+ * hardware counters of every run, as hw_counters does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "rescache.h"
+#include "prof.h"
+#include "trace.h"
+#include "libweeks.h"
+#include "mf.h"
+
+typedef struct {
+  char *deck, *out;
+} batch_job;
+
+typedef struct {
+  batch_job *job;
+  int njob;
+  int next;                 /* next deck to hand out */
+  int turn;                 /* next deck to admit */
+  int running;
+  double used, budget;      /* bytes admitted, bytes available */
+  int failed;
+  int bypass;               /* -n, solve even stored runs */
+  const char *profile;      /* -p, default profile_file or NULL */
+  int hw;                   /* -H, hardware counters of every run */
+  pthread_mutex_t lock;
+  pthread_cond_t admit;
+} batch_state;
+
+static double now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec+1e-6*tv.tv_usec;
+}
+
+/* Listing name of deck: its name with .yaml (or .yml) replaced by .out,
+ * in dir if that is not NULL
+ */
+static char *out_name (const char *deck, const char *dir)
+{
+  const char *base, *dot;
+  char *out;
+  size_t n;
+
+  base = dir != NULL && strrchr (deck, '/') ? strrchr (deck, '/')+1 : deck;
+  dot = strrchr (base, '.');
+  if (dot == NULL || (strcmp (dot, ".yaml") != 0 && strcmp (dot, ".yml") != 0))
+    dot = base+strlen (base);
+  n = (dir ? strlen (dir)+1 : 0)+(dot-base)+5;
+  out = (char *) Malloc (n);
+  snprintf (out, n, "%s%s%.*s.out", dir ? dir : "", dir ? "/" : "",
+            (int) (dot-base), base);
+  return out;
+}
+
+static char *copy_string (const char *s)
+{
+  char *c;
+
+  c = (char *) Malloc (strlen (s)+1);
+  strcpy (c, s);
+  return c;
+}
+
+static void add_job (batch_state *b, const char *deck, const char *out,
+                     const char *dir)
+{
+  b->job = (batch_job *) Realloc (b->job, (b->njob+1)*sizeof (batch_job));
+  b->job[b->njob].deck = copy_string (deck);
+  b->job[b->njob].out = out ? copy_string (out) : out_name (deck, dir);
+  b->njob++;
+}
+
+/* Add the decks of a manifest. Returns 0 if it can not be read. */
+static int read_manifest (batch_state *b, const char *file, const char *dir)
+{
+  char line[2048], *deck, *out, *c;
+  FILE *fp;
+
+  if ((fp = fopen (file, "r")) == NULL)
+    {
+      fprintf (stderr, "ERROR: Can not open manifest '%s'\n", file);
+      return 0;
+    }
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      if ((c = strchr (line, '#')) != NULL)
+        *c = '\0';
+      deck = strtok (line, " \t\r\n");
+      if (deck == NULL)
+        continue;
+      out = strtok (NULL, " \t\r\n");
+      add_job (b, deck, out, dir);
+    }
+  fclose (fp);
+  return 1;
+}
+
+/* Wait for the turn of deck k and for need bytes of the budget. A deck
+ * that fails before it is admitted passes its turn with need < 0.
+ */
+static void admit (batch_state *b, int k, double need)
+{
+  pthread_mutex_lock (&b->lock);
+  while (b->turn != k ||
+         (need >= 0.0 && b->running > 0 && b->used+need > b->budget))
+    pthread_cond_wait (&b->admit, &b->lock);
+  b->turn++;
+  if (need >= 0.0)
+    {
+      b->used += need;
+      b->running++;
+    }
+  pthread_cond_broadcast (&b->admit);
+  pthread_mutex_unlock (&b->lock);
+}
+
+static void release (batch_state *b, double need)
+{
+  pthread_mutex_lock (&b->lock);
+  b->used -= need;
+  b->running--;
+  pthread_cond_broadcast (&b->admit);
+  pthread_mutex_unlock (&b->lock);
+}
+
+/* Run deck k. Returns 1 if its listing was written. */
+static int run_deck (batch_state *b, int k, double *need)
+{
+  batch_job *j = &b->job[k];
+  weeks_ctx *ctx;
+  conductor *test;
+  int N, ok;
+
+  *need = -1.0;
+  ctx = weeks_create ();
+  if (b->profile != NULL)
+    strncpy (ctx->profile_file, b->profile, sizeof (ctx->profile_file)-1);
+  ctx->hw_counters = b->hw;
+  test = weeks_load (ctx, j->deck, &N);
+  if (test == NULL)
+    {
+      admit (b, k, -1.0);
+      weeks_destroy (ctx);
+      return 0;
+    }
+  ctx->result_bypass = b->bypass;
+  if (ctx->threads == 0)
+    ctx->threads = 1;
+  if (ctx->memory_budget <= 0.0)
+    ctx->memory_budget = b->budget;
+
+  *need = weeks_footprint (ctx, test, N);
+  if (*need > b->budget)
+    *need = b->budget;
+  admit (b, k, *need);
+  if (*need < 0.0)
+    ok = 0;
+  else if ((ctx->out = fopen (j->out, "w")) == NULL)
+    {
+      fprintf (stderr, "\nERROR: Can not write %s", j->out);
+      ok = 0;
+    }
+  else
+    {
+      ok = weeks_run (ctx, test, N, weeks_report, ctx);
+      ok &= fclose (ctx->out) == 0;
+    }
+  if (*need >= 0.0)
+    release (b, *need);
+  Free (test);
+  weeks_destroy (ctx);
+  return ok;
+}
+
+static void *batch_worker (void *arg)
+{
+  batch_state *b = (batch_state *) arg;
+  double t, need;
+  int k, ok;
+
+  TRACE_THREAD ("batch worker");
+  for (;;)
+    {
+      pthread_mutex_lock (&b->lock);
+      k = b->next++;
+      pthread_mutex_unlock (&b->lock);
+      if (k >= b->njob)
+        break;
+
+      t = now ();
+      TRACE_BEGIN ("deck", k);
+      ok = run_deck (b, k, &need);
+      TRACE_END ("deck");
+      pthread_mutex_lock (&b->lock);
+      b->failed += !ok;
+      printf ("[%d/%d] %s: %s, %.1f s, %.1f MB -> %s\n", k+1, b->njob,
+              b->job[k].deck, ok ? "ok" : "FAILED", now ()-t,
+              need > 0.0 ? need/1e6 : 0.0, b->job[k].out);
+      pthread_mutex_unlock (&b->lock);
+    }
+  return NULL;
+}
+
+static void usage (void)
+{
+  fprintf (stderr, "Usage: weeks-batch [-n] [-H] [-j workers] [-m bytes] [-o dir] [-f manifest]\n"
+           "                   [-p profile.json] [-t trace.json] deck.yaml ...\n");
+  exit (EXIT_FAILURE);
+}
+
+int main (int argc, char **argv)
+{
+  batch_state b;
+  pthread_t *tid;
+  const char *dir, *manifest, *trace;
+  double t;
+  int i, c, workers, hits, misses, stored;
+
+  memset (&b, 0, sizeof (b));
+  dir = manifest = trace = NULL;
+  workers = 0;
+  while ((c = getopt (argc, argv, "nHj:m:o:f:p:t:")) != -1)
+    switch (c)
+      {
+      case 'n':
+        b.bypass = 1;
+        break;
+      case 'H':
+        b.hw = 1;
+        break;
+      case 'j':
+        workers = atoi (optarg);
+        break;
+      case 'm':
+        b.budget = atof (optarg);
+        break;
+      case 'o':
+        dir = optarg;
+        break;
+      case 'f':
+        manifest = optarg;
+        break;
+      case 'p':
+        b.profile = optarg;
+        break;
+      case 't':
+        trace = optarg;
+        break;
+      default:
+        usage ();
+      }
+  if (manifest != NULL && !read_manifest (&b, manifest, dir))
+    exit (EXIT_FAILURE);
+  for (i=optind;i<argc;i++)
+    add_job (&b, argv[i], NULL, dir);
+  if (b.njob == 0)
+    usage ();
+
+  if (workers <= 0)
+    workers = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (workers > b.njob)
+    workers = b.njob;
+  if (b.budget <= 0.0)
+    b.budget = 0.5*(double) sysconf (_SC_PHYS_PAGES)
+               *(double) sysconf (_SC_PAGESIZE);
+
+  setbuf (stdout, (char *) NULL);
+  printf ("%d deck(s) with %d worker(s) in %.1f MB\n", b.njob, workers,
+          b.budget/1e6);
+  pthread_mutex_init (&b.lock, NULL);
+  pthread_cond_init (&b.admit, NULL);
+  if (trace != NULL && !trace_start (trace))
+    exit (EXIT_FAILURE);
+  t = now ();
+  tid = (pthread_t *) Malloc (workers*sizeof (pthread_t));
+  for (i=0;i<workers;i++)
+    if (pthread_create (&tid[i], NULL, batch_worker, &b) != 0)
+      {
+        fprintf (stderr, "ERROR: Can not start batch worker %d\n", i);
+        exit (EXIT_FAILURE);
+      }
+  for (i=0;i<workers;i++)
+    pthread_join (tid[i], NULL);
+  if (!trace_stop ())
+    b.failed++;
+
+  printf ("\n========================================\n");
+  printf ("Decks: %d ok, %d failed\n", b.njob-b.failed, b.failed);
+  rc_stats (&hits, &misses, &stored);
+  if (hits+misses > 0)
+    printf ("Stored results: %d hit(s), %d miss(es), %d stored\n", hits,
+            misses, stored);
+  printf ("Time used: %.1f seconds\n", now ()-t);
+  printf ("Peak memory: %lu kbytes\n", (unsigned long) (get_max_memory()/1024));
+  printf ("Peak RSS: %lu kbytes\n", (unsigned long) (prof_peak_rss ()/1024));
+  printf ("========================================\n");
+
+  for (i=0;i<b.njob;i++)
+    {
+      Free (b.job[i].deck);
+      Free (b.job[i].out);
+    }
+  Free (b.job);
+  Free (tid);
+  pthread_mutex_destroy (&b.lock);
+  pthread_cond_destroy (&b.admit);
+  return b.failed > 0;
+}
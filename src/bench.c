@@ -0,0 +1,543 @@
+/* bench.c - microbenchmarks of the solver kernels
+ *
+ *   weeks-bench [-r reps] [-w warmup] [-k kernel,...] [-n size,...]
+ *               [-f csv|json] [-o file] [-l label]
+ *
+ * Times the kernels the solves spend their time in, each on its own:
+ *
+ *   F            one term of the Lp integral (lpp.c)
+ *   lp           partial inductance of an element pair
+ *   calclp_row   one row of the Lp fill of an n element mesh
+ *   zLUfactor    LU of an n x n complex matrix
+ *   zLsolve      forward substitution with its L
+ *   zUsolve      back substitution with its U
+ *   __zmltadd__  complex axpy of length n
+ *   __zip__      complex inner product of length n
+ *
+ * F and lp have no size; the others run over their default sizes or
+ * those of -n. A sample calls a kernel often enough to take about a
+ * millisecond, calibrated before the warmup samples (-w, 3) that are
+ * not kept; kernels that change their input (zLUfactor) are given a
+ * fresh copy before every call, untimed, and take one call per sample.
+ * Of the -r samples (31) the time per call is reported as the minimum,
+ * the 10th percentile, the median, the 90th percentile and the maximum,
+ * in nanoseconds, with the GFLOP/s of the median where the flops are
+ * known.
+ *
+ * Each row carries the label of -l (make bench-kernels gives it the
+ * git commit), so the CSV files of several commits can be concatenated
+ * and compared; -f json writes {"label":...,"results":[...]} instead.
+ * The inputs come from a fixed seed and are the same on every run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "montecarlo.h"
+#include "lpp.h"
+#include "prof.h"
+#include "mf.h"
+
+#define BENCH_ARGS   1024        /* argument sets of F and lp, cycled */
+#define BENCH_SAMPLE 1000000     /* ns a sample should take */
+#define MAX_SIZES    16
+
+typedef struct {
+  int n;
+  uint64_t seed;
+  double (*args)[4];            /* F */
+  element *e;                   /* lp, calclp_row */
+  element e0;
+  int *pair;                    /* lp: element indices, two per call */
+  int row;                      /* calclp_row */
+  MAT *L;
+  ZMAT *A, *LU;
+  PERM *pivot;
+  ZVEC *b, *x;
+  complex *u, *v, s;
+  int k;                        /* next argument set */
+  volatile double sink;         /* results, so no call is optimized away */
+} bench;
+
+typedef struct {
+  const char *name;
+  int sizes[MAX_SIZES];         /* defaults, 0 ends; {1} has no size */
+  void (*setup) (bench *);
+  void (*prepare) (bench *);    /* untimed before every call, or NULL */
+  void (*run) (bench *);
+  double (*flops) (int n);      /* per call, or NULL */
+} kernel;
+
+/* A strip of n elements, four rows of n/4 columns (the first n%4 rows
+ * one more), 2800 x 35 um over a ground element, as a small microstrip
+ * mesh would have them
+ */
+static void mesh (bench *B, int n)
+{
+  int i, j, r, cols;
+  double w, h;
+
+  h = 35e-6/4;
+  B->e = (element *) Malloc (n*sizeof (element));
+  for (r=i=0;r<4;r++)
+    {
+      cols = n/4+(r < n%4);
+      w = cols > 0 ? 2800e-6/cols : 0.0;
+      for (j=0;j<cols;j++,i++)
+        {
+          B->e[i].x1 = j*w;
+          B->e[i].x2 = B->e[i].x1+w;
+          B->e[i].y1 = 1.6e-3+r*h;
+          B->e[i].y2 = B->e[i].y1+h;
+        }
+    }
+  B->e0.x1 = -5e-3;
+  B->e0.x2 = 7.8e-3;
+  B->e0.y1 = 0.0;
+  B->e0.y2 = 35e-6;
+}
+
+/* A diagonally dominant complex matrix, so that LU needs no pivoting
+ * beyond what zLUfactor chooses and the substitutions stay bounded
+ */
+static ZMAT *zm_bench (bench *B, int n)
+{
+  ZMAT *A;
+  int i, j;
+
+  A = zm_get (n, n);
+  for (i=0;i<n;i++)
+    for (j=0;j<n;j++)
+      {
+        A->me[i][j].re = uniform01 (&B->seed)-0.5;
+        A->me[i][j].im = uniform01 (&B->seed)-0.5;
+      }
+  for (i=0;i<n;i++)
+    A->me[i][i].re += n;
+  return A;
+}
+
+static ZVEC *zv_bench (bench *B, int n)
+{
+  ZVEC *x;
+  int i;
+
+  x = zv_get (n);
+  for (i=0;i<n;i++)
+    {
+      x->ve[i].re = uniform01 (&B->seed)-0.5;
+      x->ve[i].im = uniform01 (&B->seed)-0.5;
+    }
+  return x;
+}
+
+static void setup_F (bench *B)
+{
+  int i;
+  double x, y;
+
+  B->args = (double (*)[4]) Malloc (BENCH_ARGS*sizeof (*B->args));
+  for (i=0;i<BENCH_ARGS;i++)
+    {
+      x = 2e-3*(uniform01 (&B->seed)-0.5);
+      y = 2e-3*(uniform01 (&B->seed)-0.5);
+      B->args[i][0] = x;
+      B->args[i][1] = y;
+      B->args[i][2] = x*x;
+      B->args[i][3] = y*y;
+    }
+}
+
+static void run_F (bench *B)
+{
+  double *a = B->args[B->k];
+
+  B->sink += F (a[0], a[1], a[2], a[3]);
+  B->k = (B->k+1) & (BENCH_ARGS-1);
+}
+
+static void setup_lp (bench *B)
+{
+  int i;
+
+  mesh (B, 64);
+  B->pair = (int *) Malloc (2*BENCH_ARGS*sizeof (int));
+  for (i=0;i<2*BENCH_ARGS;i++)
+    B->pair[i] = (int) (64*uniform01 (&B->seed));
+}
+
+static void run_lp (bench *B)
+{
+  int *p = &B->pair[2*B->k];
+
+  B->sink += lp (&B->e[p[0]], &B->e[p[1]]);
+  B->k = (B->k+1) & (BENCH_ARGS-1);
+}
+
+static void setup_row (bench *B)
+{
+  mesh (B, B->n);
+  B->L = m_get (B->n, B->n);
+  B->row = B->n/2;
+}
+
+static void run_row (bench *B)
+{
+  calclp_rows (B->L, B->e, B->e0, &B->row, 1);
+  B->sink += B->L->me[B->row][0];
+}
+
+static void setup_factor (bench *B)
+{
+  B->A = zm_bench (B, B->n);
+  B->LU = zm_get (B->n, B->n);
+  B->pivot = px_get (B->n);
+}
+
+static void prepare_factor (bench *B)
+{
+  zm_copy (B->A, B->LU);
+}
+
+static void run_factor (bench *B)
+{
+  zLUfactor (B->LU, B->pivot);
+  B->sink += B->LU->me[B->n-1][B->n-1].re;
+}
+
+static void setup_solve (bench *B)
+{
+  setup_factor (B);
+  prepare_factor (B);
+  zLUfactor (B->LU, B->pivot);
+  B->b = zv_bench (B, B->n);
+  B->x = zv_get (B->n);
+}
+
+static void run_lsolve (bench *B)
+{
+  zLsolve (B->LU, B->b, B->x, 1.0);
+  B->sink += B->x->ve[B->n-1].re;
+}
+
+static void run_usolve (bench *B)
+{
+  zUsolve (B->LU, B->b, B->x, 0.0);
+  B->sink += B->x->ve[0].re;
+}
+
+static void setup_vec (bench *B)
+{
+  B->b = zv_bench (B, B->n);
+  B->x = zv_bench (B, B->n);
+  B->u = B->x->ve;
+  B->v = B->b->ve;
+  B->s.re = 1e-9;
+  B->s.im = -1e-9;
+}
+
+static void run_zmltadd (bench *B)
+{
+  __zmltadd__ (B->u, B->v, B->s, B->n, Z_NOCONJ);
+  B->sink += B->u[0].re;
+}
+
+static void run_zip (bench *B)
+{
+  B->sink += __zip__ (B->u, B->v, B->n, Z_NOCONJ).re;
+}
+
+static double flops_lu (int n)
+{
+  return PROF_LU_FLOPS (n);
+}
+
+/* One triangle, half of PROF_SOLVE_FLOPS */
+static double flops_tri (int n)
+{
+  return 0.5*PROF_SOLVE_FLOPS (n, 1);
+}
+
+static double flops_vec (int n)
+{
+  return 8.0*n;
+}
+
+static const kernel kernels[] = {
+  {"F", {1}, setup_F, NULL, run_F, NULL},
+  {"lp", {1}, setup_lp, NULL, run_lp, NULL},
+  {"calclp_row", {64, 256, 1024, 2048}, setup_row, NULL, run_row, NULL},
+  {"zLUfactor", {64, 128, 256, 512}, setup_factor, prepare_factor,
+   run_factor, flops_lu},
+  {"zLsolve", {64, 256, 1024}, setup_solve, NULL, run_lsolve, flops_tri},
+  {"zUsolve", {64, 256, 1024}, setup_solve, NULL, run_usolve, flops_tri},
+  {"__zmltadd__", {16, 256, 4096, 65536}, setup_vec, NULL, run_zmltadd,
+   flops_vec},
+  {"__zip__", {16, 256, 4096, 65536}, setup_vec, NULL, run_zip, flops_vec},
+};
+
+#define NKERNELS ((int) (sizeof (kernels)/sizeof (kernels[0])))
+
+static void clean (bench *B)
+{
+  Free (B->args);
+  Free (B->e);
+  Free (B->pair);
+  M_FREE (B->L);
+  ZM_FREE (B->A);
+  ZM_FREE (B->LU);
+  PX_FREE (B->pivot);
+  ZV_FREE (B->b);
+  ZV_FREE (B->x);
+}
+
+/* Time of iters calls in ns */
+static uint64_t sample (const kernel *K, bench *B, long iters)
+{
+  uint64_t t, ns;
+  long i;
+
+  if (K->prepare == NULL)
+    {
+      t = prof_now ();
+      for (i=0;i<iters;i++)
+        K->run (B);
+      return prof_now ()-t;
+    }
+  ns = 0;
+  for (i=0;i<iters;i++)
+    {
+      K->prepare (B);
+      t = prof_now ();
+      K->run (B);
+      ns += prof_now ()-t;
+    }
+  return ns;
+}
+
+static int cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile q of the sorted t[0..n-1] */
+static double percentile (const double *t, int n, double q)
+{
+  int i;
+
+  i = (int) ceil (q*n)-1;
+  return t[i < 0 ? 0 : i >= n ? n-1 : i];
+}
+
+typedef struct {
+  FILE *fp;
+  int json, rows;
+  const char *label;
+} output;
+
+/* Write s as a JSON string */
+static void json_string (FILE *fp, const char *s)
+{
+  putc ('"', fp);
+  for (;*s!='\0';s++)
+    if (*s == '"' || *s == '\\')
+      fprintf (fp, "\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      fprintf (fp, "\\u%04x", (unsigned char) *s);
+    else
+      putc (*s, fp);
+  putc ('"', fp);
+}
+
+static void report (output *o, const kernel *K, int n, int reps, long iters,
+                    double *t)
+{
+  double med, gflops;
+
+  qsort (t, reps, sizeof (double), cmp_double);
+  med = percentile (t, reps, 0.5);
+  gflops = K->flops != NULL && med > 0.0 ? K->flops (n)/med : 0.0;
+  if (o->json)
+    fprintf (o->fp, "%s\n{\"kernel\":\"%s\",\"size\":%d,\"reps\":%d,\"iters\":%ld,"
+             "\"min_ns\":%.1f,\"p10_ns\":%.1f,\"median_ns\":%.1f,"
+             "\"p90_ns\":%.1f,\"max_ns\":%.1f,\"gflops\":%.3f}",
+             o->rows ? "," : "", K->name, n, reps, iters, t[0],
+             percentile (t, reps, 0.1), med, percentile (t, reps, 0.9),
+             t[reps-1], gflops);
+  else
+    fprintf (o->fp, "%s,%s,%d,%d,%ld,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f\n",
+             o->label, K->name, n, reps, iters, t[0],
+             percentile (t, reps, 0.1), med, percentile (t, reps, 0.9),
+             t[reps-1], gflops);
+  o->rows++;
+}
+
+/* Calibrate, warm up and sample kernel K at size n */
+static void measure (output *o, const kernel *K, int n, int reps, int warmup)
+{
+  bench B;
+  double *t;
+  long iters;
+  int i;
+
+  memset (&B, 0, sizeof (B));
+  B.n = n;
+  B.seed = 1;
+  K->setup (&B);
+  iters = 1;
+  if (K->prepare == NULL)
+    while (sample (K, &B, iters) < BENCH_SAMPLE/2 && iters < (1L << 24))
+      iters *= 2;
+  for (i=0;i<warmup;i++)
+    sample (K, &B, iters);
+  t = (double *) Malloc (reps*sizeof (double));
+  for (i=0;i<reps;i++)
+    t[i] = (double) sample (K, &B, iters)/iters;
+  report (o, K, n, reps, iters, t);
+  fprintf (stderr, "%-12s %6d  median %.1f ns\n", K->name, n,
+           percentile (t, reps, 0.5));
+  Free (t);
+  clean (&B);
+}
+
+/* Parse the comma separated sizes of s into n[], 0 ended. Returns 0 if
+ * s is not such a list.
+ */
+static int parse_sizes (const char *s, int *n)
+{
+  char *end;
+  int k = 0;
+
+  while (*s != '\0' && k < MAX_SIZES-1)
+    {
+      n[k] = (int) strtol (s, &end, 10);
+      if (end == s || n[k] < 1 || (*end != ',' && *end != '\0'))
+        return 0;
+      k++;
+      s = *end == ',' ? end+1 : end;
+    }
+  n[k] = 0;
+  return k > 0;
+}
+
+static int selected (const char *list, const char *name)
+{
+  size_t len = strlen (name);
+  const char *p;
+
+  if (list == NULL)
+    return 1;
+  for (p=list; (p = strstr (p, name)) != NULL; p += len)
+    if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+      return 1;
+  return 0;
+}
+
+static void usage (void)
+{
+  int i;
+
+  fprintf (stderr, "Usage: weeks-bench [-r reps] [-w warmup] [-k kernel,...] [-n size,...]\n"
+           "                   [-f csv|json] [-o file] [-l label]\n"
+           "Kernels:");
+  for (i=0;i<NKERNELS;i++)
+    fprintf (stderr, " %s", kernels[i].name);
+  fprintf (stderr, "\n");
+  exit (EXIT_FAILURE);
+}
+
+int main (int argc, char **argv)
+{
+  output o;
+  const char *list, *file;
+  const int *n;
+  int sizes[MAX_SIZES], c, i, j, reps, warmup, own, found;
+
+  memset (&o, 0, sizeof (o));
+  o.label = "";
+  list = file = NULL;
+  reps = 31;
+  warmup = 3;
+  own = 0;
+  while ((c = getopt (argc, argv, "r:w:k:n:f:o:l:")) != -1)
+    switch (c)
+      {
+      case 'r':
+        reps = atoi (optarg);
+        break;
+      case 'w':
+        warmup = atoi (optarg);
+        break;
+      case 'k':
+        list = optarg;
+        break;
+      case 'n':
+        if (!parse_sizes (optarg, sizes))
+          usage ();
+        own = 1;
+        break;
+      case 'f':
+        if (strcmp (optarg, "json") == 0)
+          o.json = 1;
+        else if (strcmp (optarg, "csv") != 0)
+          usage ();
+        break;
+      case 'o':
+        file = optarg;
+        break;
+      case 'l':
+        o.label = optarg;
+        break;
+      default:
+        usage ();
+      }
+  if (reps < 1 || warmup < 0 || optind < argc)
+    usage ();
+  found = 0;
+  for (i=0;i<NKERNELS;i++)
+    found += selected (list, kernels[i].name);
+  if (found == 0)
+    usage ();
+
+  o.fp = stdout;
+  if (file != NULL && (o.fp = fopen (file, "w")) == NULL)
+    {
+      fprintf (stderr, "ERROR: Can not write '%s'\n", file);
+      exit (EXIT_FAILURE);
+    }
+  if (o.json)
+    {
+      fprintf (o.fp, "{\"label\":");
+      json_string (o.fp, o.label);
+      fprintf (o.fp, ",\"results\":[");
+    }
+  else
+    fprintf (o.fp, "label,kernel,size,reps,iters,min_ns,p10_ns,median_ns,"
+             "p90_ns,max_ns,gflops\n");
+
+  for (i=0;i<NKERNELS;i++)
+    {
+      if (!selected (list, kernels[i].name))
+        continue;
+      n = own && kernels[i].sizes[0] != 1 ? sizes : kernels[i].sizes;
+      for (j=0;n[j]>0;j++)
+        measure (&o, &kernels[i], n[j], reps, warmup);
+    }
+
+  if (o.json)
+    fprintf (o.fp, "\n]}\n");
+  if (fclose (o.fp) != 0)
+    {
+      fprintf (stderr, "ERROR: Can not write '%s'\n", file ? file : "stdout");
+      exit (EXIT_FAILURE);
+    }
+  return 0;
+}
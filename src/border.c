@@ -0,0 +1,242 @@
+/* border.c - growing a factored element matrix by new conductors
+ *
+ * Adding a conductor to a solved cross-section appends its k elements
+ * to the end of the element list (conductors are contiguous), so with
+ * P A = L U already known the new matrix is bordered:
+ *
+ *   A' = [A  B]     P' A' = [L    0 ] [U  U12]
+ *        [C  D]             [L21  Ls] [0  Us ]
+ *
+ *   U12 = L^-1 P B,  L21' = C U^-1,  S = D - L21' U12,  Ps S = Ls Us
+ *
+ * with L21 = Ps L21' and P' = diag (P, Ps). The result is a plain LU
+ * factorization of A' for zzLUsolve and port_reduce, and can be bordered
+ * again. It costs O(M^2 k) for the two triangular solves with the old
+ * factors and O(k^3) for S instead of O((M+k)^3). Z is complex
+ * symmetric, so C = B' and only the new rows of Z are needed.
+ *
+ * The ground plane mesh and e0 do not change when conductors are
+ * added; mesh_conductors is given the final set of conductors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "border.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+/* Border the factorization LU, pivot of the M x M matrix A with the k
+ * rows Zb = [C D] (k x M+k) of the grown symmetric matrix. Returns the
+ * factors of the grown matrix and its pivot in *pnew; LU and pivot are
+ * freed.
+ */
+ZMAT *zLUborder (ZMAT *LU, PERM *pivot, const ZMAT *Zb, PERM **pnew)
+{
+  int M, k, m, i, j, t, u;
+  ZMAT *F, *Ut, *S;
+  ZVEC *b, *y;
+  PERM *ps, *px;
+  complex c;
+
+  M = LU->m;
+  k = Zb->m;
+  m = M+k;
+  F = zm_get (m, m);
+  for (i=0;i<M;i++)
+    MEMCOPY (LU->me[i], F->me[i], M, complex);
+
+  /* U12 = L^-1 P B, kept transposed in Ut for the products below */
+  Ut = zm_get (k, M);
+  b = zv_get (M);
+  y = zv_get (M);
+  for (t=0;t<k;t++)
+    {
+      MEMCOPY (Zb->me[t], b->ve, M, complex);
+      px_zvec (pivot, b, y);
+      zLsolve (LU, y, y, 1.0);
+      MEMCOPY (y->ve, Ut->me[t], M, complex);
+      for (i=0;i<M;i++)
+        F->me[i][M+t] = y->ve[i];
+    }
+
+  /* L21' = C U^-1, row by row: x U = c */
+  for (t=0;t<k;t++)
+    {
+      complex *x = F->me[M+t];
+
+      MEMCOPY (Zb->me[t], x, M, complex);
+      for (j=0;j<M;j++)
+        {
+          x[j] = zdiv (x[j], LU->me[j][j]);
+          c = zneg (x[j]);
+          __zmltadd__ (&x[j+1], &LU->me[j][j+1], c, M-j-1, Z_NOCONJ);
+        }
+    }
+
+  /* Schur complement S = D - L21' U12 */
+  S = zm_get (k, k);
+  for (t=0;t<k;t++)
+    for (u=0;u<k;u++)
+      S->me[t][u] = zsub (Zb->me[t][M+u],
+                          __zip__ (F->me[M+t], Ut->me[u], M, Z_NOCONJ));
+  ps = px_get (k);
+  port_factor (S, ps);
+
+  /* L21 = Ps L21', then the factors of S */
+  for (t=0;t<k;t++)
+    MEMCOPY (F->me[M+t], Ut->me[t], M, complex);
+  for (t=0;t<k;t++)
+    {
+      MEMCOPY (Ut->me[ps->pe[t]], F->me[M+t], M, complex);
+      MEMCOPY (S->me[t], &F->me[M+t][M], k, complex);
+    }
+
+  px = px_get (m);
+  for (i=0;i<M;i++)
+    px->pe[i] = pivot->pe[i];
+  for (t=0;t<k;t++)
+    px->pe[M+t] = M+ps->pe[t];
+  *pnew = px;
+
+  PX_FREE (ps);
+  ZM_FREE (S);
+  ZV_FREE (b);
+  ZV_FREE (y);
+  ZM_FREE (Ut);
+  PX_FREE (pivot);
+  ZM_FREE (LU);
+  return F;
+}
+
+/* Rows m0..m-1 of Z = R + jwL of the first m elements */
+static ZMAT *border_rows (const bordered *bd, int m0, int m)
+{
+  MAT *B;
+  ZMAT *Zb;
+  int t, j;
+  double r00;
+
+  B = m_get (m-m0, m);
+  calclp_border (B, bd->e, bd->e0, m0, m);
+  r00 = calc_r00 (bd->e0, bd->Omega, bd->cond);
+  Zb = zm_get (m-m0, m);
+  for (t=0;t<m-m0;t++)
+    {
+      for (j=0;j<m;j++)
+        {
+          Zb->me[t][j].re = r00;
+          Zb->me[t][j].im = bd->Omega*B->me[t][j];
+        }
+      if (m0+t >= bd->n0)
+        Zb->me[t][m0+t].re += calc_element_loss (&bd->e[m0+t], bd->Omega,
+                                                 bd->cond, bd->N);
+    }
+  M_FREE (B);
+  return Zb;
+}
+
+/* Factor Z of the first m elements of e (ground plane and the first
+ * signal conductors) at Omega. e and cond must stay valid while bd is
+ * in use; later conductors are added with bd_extend.
+ */
+bordered *bd_factor (element *e, element e0, int m, int n0,
+                     conductor *cond, int N, double Omega)
+{
+  bordered *bd;
+  MAT *L;
+
+  bd = (bordered *) Calloc (1, sizeof (bordered));
+  bd->e = e;
+  bd->e0 = e0;
+  bd->n0 = n0;
+  bd->m = m;
+  bd->cond = cond;
+  bd->N = N;
+  bd->Omega = Omega;
+
+  L = m_get (m, m);
+  calclp (L, e, e0);
+  bd->LU = zm_get (m, m);
+  calcz (bd->LU, L, e, n0, Omega, e0, cond, N);
+  M_FREE (L);
+  bd->pivot = px_get (m);
+  port_factor (bd->LU, bd->pivot);
+  return bd;
+}
+
+/* Grow the factored system to the first m elements */
+void bd_extend (bordered *bd, int m)
+{
+  ZMAT *Zb;
+  PERM *px;
+
+  if (m <= bd->m)
+    return;
+  Zb = border_rows (bd, bd->m, m);
+  bd->LU = zLUborder (bd->LU, bd->pivot, Zb, &px);
+  bd->pivot = px;
+  bd->m = m;
+  ZM_FREE (Zb);
+}
+
+/* Port admittance of the first N signal conductors, which must make up
+ * the factored elements
+ */
+ZMAT *bd_ports (const bordered *bd, int N, ZMAT *y)
+{
+  return port_reduce (bd->LU, bd->pivot, bd->n0, bd->cond, N, y);
+}
+
+void bd_free (bordered *bd)
+{
+  PX_FREE (bd->pivot);
+  ZM_FREE (bd->LU);
+  Free (bd);
+}
+
+/* Solve the cross-section with line1 only, then add the other signal
+ * conductors one at a time, reporting the port impedance of every stage
+ * at every frequency. e is the mesh of all N conductors.
+ */
+void incremental (element *e, element e0, int n0, conductor *cond, int N,
+                  const double *freq, int nfreq, sweep_report report,
+                  void *arg)
+{
+  bordered **bd;
+  ZMAT *y;
+  int i, k, m;
+
+  bd = (bordered **) Calloc (nfreq, sizeof (bordered *));
+  m = n0;
+  for (i=1;i<=N;i++)
+    {
+      m += cond[i].n;
+      fprintf (stderr, "\n\nStage %d/%d: line1..line%d (%d elements)",
+               i, N, i, m);
+      for (k=0;k<nfreq;k++)
+        {
+          if (i == 1)
+            bd[k] = bd_factor (e, e0, m, n0, cond, N,
+                                2.0*PI*freq[k]);
+          else
+            bd_extend (bd[k], m);
+          y = bd_ports (bd[k], i, ZMNULL);
+          report (port_inverse (y, ZMNULL), y, freq[k], i, arg);
+          ZM_FREE (y);
+        }
+    }
+
+  for (k=0;k<nfreq;k++)
+    bd_free (bd[k]);
+  Free (bd);
+}
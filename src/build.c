@@ -1,11 +1,176 @@
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
 #include "weeks.h"
+#include "prof.h"
 #include "mf.h"
 
-element *build_elements (int M, int N, conductor *test, element *e0)
+#define AUTO_EDGE   0.5   /* edge element size in skin depths */
+#define AUTO_CENTRE 4.0   /* largest element size in skin depths */
+#define AUTO_MAXDIV 201   /* upper limit on nw and nh */
+
+/* Skin depth in copper at frequency f */
+double skin_depth (double f)
+{
+  return 1.0/sqrt(3.141592653589793116*f*MU0*SIGMA_COPPER);
+}
+
+/* Odd number of divisions of size about 'size', at least nmin */
+static int auto_divisions (double len, double size, int nmin)
+{
+  int n;
+
+  n = (int) ceil (len/size);
+  if (n > AUTO_MAXDIV)
+    n = AUTO_MAXDIV;
+  if (n < nmin)
+    n = nmin;
+  if (n%2 == 0)
+    n++;
+  return n;
+}
+
+/* Choose nw, nh and b for every conductor in MESH_AUTO mode from the
+ * skin depth at frequency f (the highest frequency of a sweep).
+ *
+ * Signal conductors get graded elements of AUTO_EDGE skin depths at the
+ * surface growing linearly to at most AUTO_CENTRE skin depths (or a
+ * third of the conductor) in the middle, which is the grading that
+ * build_elements produces for b = edge/centre. The ground plane is
+ * meshed uniformly, so its element width follows the distance to the
+ * nearest signal conductor, which sets the spread of the return
+ * current, bounded below by twice the skin depth.
+ */
+void auto_mesh (const weeks_ctx *ctx, int N, conductor *test, double f)
+{
+  int i, j, mode;
+  double delta, edge, cw, ch, gap, size;
+
+  delta = skin_depth (f);
+  edge = AUTO_EDGE*delta;
+  fprintf (stderr, "\nSkin depth at %.2e Hz: %.3e m", f, delta);
+
+  for (i=0;i<=N;i++)
+    {
+      mode = test[i].mesh == MESH_DEFAULT ? ctx->mesh : test[i].mesh;
+      if (mode != MESH_AUTO)
+        continue;
+
+      if (i == 0)
+        {
+          gap = test[0].w;
+          for (j=1;j<=N;j++)
+            if (test[j].y - (test[0].y+test[0].h) < gap)
+              gap = test[j].y - (test[0].y+test[0].h);
+          if (gap <= 0.0)
+            gap = test[0].w/AUTO_MAXDIV;
+          size = 2.0*delta;
+          if (size < gap/4)
+            size = gap/4;
+          if (size > gap)
+            size = gap;
+          test[0].nw = auto_divisions (test[0].w, size, 1);
+          test[0].nh = auto_divisions (test[0].h, delta, 1);
+          test[0].b = 1.0;
+        }
+      else
+        {
+          cw = AUTO_CENTRE*delta;
+          if (cw > test[i].w/3)
+            cw = test[i].w/3;
+          ch = AUTO_CENTRE*delta;
+          if (ch > test[i].h/3)
+            ch = test[i].h/3;
+          /* one b grades both directions, set by the wider one */
+          test[i].b = edge/(cw > ch ? cw : ch);
+          if (test[i].b > 1.0)
+            test[i].b = 1.0;
+          /* mean element size of the linear grading is (1+b)/2 * centre */
+          test[i].nw = auto_divisions (test[i].w, 0.5*(1.0+test[i].b)*cw, 3);
+          test[i].nh = auto_divisions (test[i].h, 0.5*(1.0+test[i].b)*ch, 3);
+        }
+      test[i].n = test[i].nw*test[i].nh;
+      fprintf (stderr, "\n  Auto mesh line%d: nw=%d nh=%d b=%.3f (%d elements)",
+               i, test[i].nw, test[i].nh, test[i].b, test[i].n);
+    }
+}
+
+/* Select surface shell meshing for the signal conductors. f is the
+ * lowest frequency of the run: the shell must hold the current at every
+ * frequency point. Conductors too thin to have a dead interior keep the
+ * full cross-section.
+ */
+void shell_mesh (const weeks_ctx *ctx, int N, conductor *test, double f)
+{
+  int i;
+  double t;
+
+  if (ctx->shell == SHELL_OFF ||
+      (ctx->shell == SHELL_AUTO && f < ctx->shell_frequency))
+    return;
+
+  t = ctx->shell_depth*skin_depth (f);
+  for (i=1;i<=N;i++)
+    if (2.0*t < test[i].w && 2.0*t < test[i].h)
+      {
+        test[i].shell = t;
+        fprintf (stderr, "\n  Shell mesh line%d: %.3e m deep", i, t);
+      }
+}
+
+/* Select the ground plane mesh. A graded ground has columns of
+ * ground_min width under the signal conductors, growing by ground_grade
+ * per unit of horizontal distance up to ground_max; ground_min defaults
+ * to the column width of the uniform mesh given in the input. An image
+ * ground is not meshed at all: line0 only gives the position of the
+ * ground surface and the dielectric.
+ */
+void ground_mesh (const weeks_ctx *ctx, int N, conductor *test)
+{
+  if (ctx->ground_mesh == GROUND_IMAGE)
+    {
+      test[0].mesh = MESH_IMAGE;
+      fprintf (stderr, "\n  Ideal ground plane at y=%.3e m (image method)",
+               test[0].y+test[0].h);
+      return;
+    }
+  if (ctx->ground_mesh != GROUND_GRADED)
+    return;
+
+  test[0].gmin = ctx->ground_min > 0.0 ? ctx->ground_min
+                                       : test[0].w/test[0].nw;
+  test[0].gmax = ctx->ground_max > 0.0 ? ctx->ground_max
+                                       : 10.0*test[0].gmin;
+  test[0].grade = ctx->ground_grade;
+  if (test[0].gmax < test[0].gmin)
+    test[0].gmax = test[0].gmin;
+}
+
+/* Keep only the elements of conductor c that reach into its surface
+ * shell. Compacts e[first..first+c->n) in place and returns the number
+ * of elements kept.
+ */
+static int shell_filter (element *e, int first, conductor *c)
+{
+  int i, m;
+  double d;
+
+  m = first;
+  for (i=first;i<first+c->n;i++)
+    {
+      d = fmin (fmin (e[i].x1-c->x, c->x+c->w-e[i].x2),
+                fmin (e[i].y1-c->y, c->y+c->h-e[i].y2));
+      if (d < c->shell)
+        e[m++] = e[i];
+    }
+  return m-first;
+}
+
+element *build_elements (int M, int N, conductor *test, element *e0,
+                         const double *xcol)
 {
   int i,j,k,m;
-  double wl, hl, xx, dx, wt;
+  double wl, hl, xx, dx, wt, xl, xr;
   double b,ww1, ww2, yy, dy, ht, hh1, hh2, nh2, nw2;
   element *e;
 
@@ -20,6 +185,9 @@ element *build_elements (int M, int N, conductor *test, element *e0)
         {
           for(k=0;k<test[0].nw;k++)
             {
+              /* uniform columns unless a graded ground is given */
+              xl = xcol ? xcol[k] : test[0].x+wl*k;
+              xr = xcol ? xcol[k+1] : test[0].x+wl*(k+1);
               if(j==0 && k==test[0].nw/2)
                 {
                   /*
@@ -28,15 +196,15 @@ element *build_elements (int M, int N, conductor *test, element *e0)
                   *y01 = test[0].y;
                   *y02 = test[0].y+hl;
                   */
-                  e0->x1 = test[0].x+wl*k;
-                  e0->x2 = test[0].x+wl*(k+1);
+                  e0->x1 = xl;
+                  e0->x2 = xr;
                   e0->y1 = test[0].y;
                   e0->y2 = test[0].y+hl;
                 }
               else
                 {
-                  e[m].x1 = test[0].x+wl*k;
-                  e[m].x2 = test[0].x+wl*(k+1);
+                  e[m].x1 = xl;
+                  e[m].x2 = xr;
                   e[m].y1 = test[0].y+hl*j;
                   e[m].y2 = test[0].y+hl*(j+1);
                   m++;
@@ -82,8 +250,161 @@ element *build_elements (int M, int N, conductor *test, element *e0)
   return e;
 }
 
+/* Width of a graded ground plane column starting at x: gmin under the
+ * signal conductors, growing by grade per unit of horizontal distance
+ * to the nearest one, at most gmax.
+ */
+static double column_width (conductor *test, int N, double x)
+{
+  int i;
+  double d, dmin, s;
 
+  dmin = test[0].w;
+  for (i=1;i<=N;i++)
+    {
+      if (x < test[i].x)
+        d = test[i].x-x;
+      else if (x > test[i].x+test[i].w)
+        d = x-(test[i].x+test[i].w);
+      else
+        d = 0.0;
+      if (d < dmin)
+        dmin = d;
+    }
+  s = test[0].gmin+test[0].grade*dmin;
+  return s > test[0].gmax ? test[0].gmax : s;
+}
 
+/* March from x0 towards the edge at x1 (either direction), storing the
+ * column edges after x0 in c[]. A last column narrower than half its
+ * graded width is merged into the one before. Returns the count.
+ */
+static int march_columns (conductor *test, int N, double x0, double x1,
+                          double *c)
+{
+  int n;
+  double x, s, dir;
 
+  dir = x1 > x0 ? 1.0 : -1.0;
+  n = 0;
+  x = x0;
+  while (dir*(x1-x) > 0.0)
+    {
+      s = column_width (test, N, x);
+      if (dir*(x1-x) < 1.5*s)
+        {
+          if (dir*(x1-x) < 0.5*s && n > 0)
+            n--;
+          c[n++] = x1;
+          break;
+        }
+      x += dir*s;
+      c[n++] = x;
+    }
+  return n;
+}
 
+/* Column edges of a graded ground plane (test[0].gmin > 0). A column of
+ * width column_width() is centred on the ground plane and the others are laid
+ * out towards both edges, so a symmetric layout gives a symmetric mesh.
+ * Sets test[0].nw and returns the nw+1 edges, allocated from scratch.
+ */
+static double *ground_columns (mf_arena *scratch, conductor *test, int N)
+{
+  double *left, *right, *xc, xm, s;
+  int nl, nr, k, cap;
+
+  cap = (int) (test[0].w/test[0].gmin)+4;
+  left = (double *) mf_arena_alloc (scratch, cap*sizeof (double));
+  right = (double *) mf_arena_alloc (scratch, cap*sizeof (double));
+  xm = test[0].x+0.5*test[0].w;
+  s = column_width (test, N, xm);
+  nl = march_columns (test, N, xm-0.5*s, test[0].x, left);
+  nr = march_columns (test, N, xm+0.5*s, test[0].x+test[0].w, right);
 
+  xc = (double *) mf_arena_alloc (scratch, (nl+nr+2)*sizeof (double));
+  for (k=0;k<nl;k++)
+    xc[k] = left[nl-1-k];
+  xc[nl] = xm-0.5*s;
+  xc[nl+1] = xm+0.5*s;
+  for (k=0;k<nr;k++)
+    xc[nl+2+k] = right[k];
+  test[0].nw = nl+nr+1;
+  return xc;
+}
+
+/* Count the elements of the conductors as meshed in test[] and build
+ * them, leaving out the interior of conductors with a surface shell.
+ * Returns the element list, its length in *M and the number of ground
+ * plane elements (without e0, none for an ideal ground) in *n0;
+ * test[].n is updated.
+ */
+static element *mesh_elements (int N, conductor *test, element *e0, int *M,
+                               int *n0)
+{
+  int i, first, m;
+  element *e;
+  double *xcol;
+  mf_arena *scratch;
+
+  scratch = NULL;
+  xcol = NULL;
+  if (test[0].gmin > 0.0)
+    {
+      scratch = mf_arena_create (0);
+      xcol = ground_columns (scratch, test, N);
+      fprintf (stderr, "\n  Graded ground plane: %d columns (%.2e to %.2e m)",
+               test[0].nw, test[0].gmin, test[0].gmax);
+    }
+
+  *n0 = *M = test[0].nw*test[0].nh-1;
+  for(i=1;i<=N;i++)
+    {
+      test[i].n = test[i].nw*test[i].nh;
+      *M += test[i].n;
+    }
+  e = build_elements (*M, N, test, e0, xcol);
+  mf_arena_free (scratch);
+  if (e == NULL)
+    return e;
+
+  /* An ideal ground replaces line0 and e0 by the ground surface */
+  first = *n0;
+  if (test[0].mesh == MESH_IMAGE)
+    {
+      *n0 = 0;
+      e0->x1 = test[0].x;
+      e0->x2 = test[0].x+test[0].w;
+      e0->y1 = e0->y2 = test[0].y+test[0].h;
+    }
+
+  /* Drop the interior of shell meshed conductors */
+  m = *n0;
+  for(i=1;i<=N;i++)
+    {
+      memmove (&e[m], &e[first], test[i].n*sizeof (element));
+      first += test[i].n;
+      if (test[i].shell > 0.0)
+        test[i].n = shell_filter (e, m, &test[i]);
+      m += test[i].n;
+    }
+  if (m < *M)
+    e = (element *) Realloc (e, m*sizeof (element));
+  *M = m;
+  return e;
+}
+
+/* mesh_elements, timed as the mesh phase of the run */
+element *mesh_conductors (int N, conductor *test, element *e0, int *M,
+                          int *n0)
+{
+  element *e;
+  uint64_t t;
+
+  t = prof_begin ();
+  e = mesh_elements (N, test, e0, M, n0);
+  prof_add (PROF_MESH, t);
+  if (e != NULL)
+    prof_max (PROF_ELEMENTS, *M);
+  return e;
+}
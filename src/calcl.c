@@ -8,6 +8,7 @@
 #include "zmatrix2.h"
 #include "weeks.h"
 #include "calcl.h"
+#include "prof.h"
 #include "mf.h"
 #include <math.h>
 
@@ -70,7 +71,7 @@ void calcl (ZMAT *Z, element *e, double n0, double Omega,
   int i, j;
   int dim;
   double lmm, lpi0, r00;
-  double sigma=58e6;  /* Copper conductivity S/m */
+  double sigma=SIGMA_COPPER;
   double eff_er;
   double diel_loss;
   VEC *lpj;
@@ -137,3 +138,259 @@ void calcl (ZMAT *Z, element *e, double n0, double Omega,
     Z->me[i][i].re += conductor_loss;
   }
 }
+
+/* Ground plane resistance term shared by every element (reference
+ * element e0 plus dielectric loss of line0)
+ */
+double calc_r00 (element e0, double Omega, conductor *cond)
+{
+  double sigma=SIGMA_COPPER;
+  double diel_loss = 0.0;
+
+  if (cond != NULL && cond[0].substrate_h > 0.0)
+    diel_loss = calc_dielectric_loss(cond[0].er, cond[0].tan_delta,
+                                     Omega, cond[0].w, cond[0].substrate_h);
+  if (IMAGE_GROUND (e0))
+    return diel_loss;
+  return 1/(sigma*(e0.x2-e0.x1)*(e0.y2-e0.y1)) + diel_loss;
+}
+
+/* Loop inductance of ei and ej over an ideal ground plane at the
+ * surface y = e0.y1: the partial inductance less that of ei with the
+ * image of ej, which carries the return current.
+ */
+double lp_image (element *ei, element *ej, element e0)
+{
+  element im;
+
+  im.x1 = ej->x1;
+  im.x2 = ej->x2;
+  im.y1 = 2.0*e0.y1-ej->y2;
+  im.y2 = 2.0*e0.y1-ej->y1;
+  return lp (ei, ej)-lp (ei, &im);
+}
+
+/* Frequency independent part of calcl: the real matrix of partial
+ * inductances referred to e0,
+ *   L[i][j] = Lp(e0,e0) - Lp(i,e0) - Lp(e0,j) + Lp(i,j)
+ * so that Z = R + jwL can be assembled for any frequency with calcz
+ * without calling lp() again. Over an ideal ground (IMAGE_GROUND) the
+ * entries are the loop inductances of lp_image instead.
+ */
+void calclp (MAT *L, element *e, element e0)
+{
+  int i, j;
+  int dim;
+  double lmm, lpi0;
+  VEC *lpj;
+  uint64_t t;
+  dim = L->m;
+  t = prof_begin ();
+
+  if (IMAGE_GROUND (e0))
+    {
+      for (i=0; i<dim; i++)
+        for (j=0;j<=i;j++)
+          L->me[i][j] = L->me[j][i] = lp_image (&e[i], &e[j], e0);
+      prof_add (PROF_FILL, t);
+      return;
+    }
+
+  lmm = lp (&e0, &e0);
+
+  lpj = v_get (dim);
+  for (j=0; j<dim; j++)
+    lpj->ve[j] = lp (&e0, &e[j]);
+
+  for (i=0; i<dim; i++)
+    {
+      lpi0 = lmm-lp (&e[i], &e0);
+      for (j=0;j<=i;j++)
+        L->me[i][j] = L->me[j][i] = lpi0-lpj->ve[j]+lp (&e[i], &e[j]);
+    }
+  V_FREE (lpj);
+  prof_add (PROF_FILL, t);
+}
+
+/* Fill L for a changed element list, reusing Lold. old[i] is the index
+ * in the previous list of an element that is unchanged, or -1 if
+ * element i is new. Only entries that involve a new element call the
+ * expensive lp (&e[i], &e[j]); the O(dim) terms against e0 are redone.
+ */
+void calclp_update (MAT *L, element *e, element e0, const MAT *Lold,
+                    const int *old)
+{
+  int i, j;
+  int dim;
+  double lmm, lpi0;
+  VEC *lpj;
+  uint64_t t;
+  dim = L->m;
+  t = prof_begin ();
+
+  if (IMAGE_GROUND (e0))
+    {
+      for (i=0; i<dim; i++)
+        for (j=0;j<=i;j++)
+          if (old[i] >= 0 && old[j] >= 0)
+            L->me[i][j] = L->me[j][i] = Lold->me[old[i]][old[j]];
+          else
+            L->me[i][j] = L->me[j][i] = lp_image (&e[i], &e[j], e0);
+      prof_add (PROF_FILL, t);
+      return;
+    }
+
+  lmm = lp (&e0, &e0);
+
+  lpj = v_get (dim);
+  for (j=0; j<dim; j++)
+    lpj->ve[j] = lp (&e0, &e[j]);
+
+  for (i=0; i<dim; i++)
+    {
+      lpi0 = lmm-lp (&e[i], &e0);
+      for (j=0;j<=i;j++)
+        if (old[i] >= 0 && old[j] >= 0)
+          L->me[i][j] = L->me[j][i] = Lold->me[old[i]][old[j]];
+        else
+          L->me[i][j] = L->me[j][i] = lpi0-lpj->ve[j]+lp (&e[i], &e[j]);
+    }
+  V_FREE (lpj);
+  prof_add (PROF_FILL, t);
+}
+
+/* Redo the rows and columns of L for the s elements S[] whose position
+ * or shape changed, leaving the rest of L as it is. Costs about s*dim
+ * calls of lp() instead of dim*dim/2. Entries come out exactly as
+ * calclp would compute them for the new elements.
+ */
+void calclp_rows (MAT *L, element *e, element e0, const int *S, int s)
+{
+  int i, j, t, a, b;
+  int dim;
+  double lmm;
+  VEC *li0, *l0j;
+  uint64_t t0;
+  dim = L->m;
+  t0 = prof_begin ();
+
+  if (IMAGE_GROUND (e0))
+    {
+      for (t=0; t<s; t++)
+        for (j=0; j<dim; j++)
+          {
+            a = S[t] > j ? S[t] : j;
+            b = S[t] > j ? j : S[t];
+            L->me[a][b] = L->me[b][a] = lp_image (&e[a], &e[b], e0);
+          }
+      prof_add (PROF_FILL, t0);
+      return;
+    }
+
+  lmm = lp (&e0, &e0);
+  li0 = v_get (dim);
+  l0j = v_get (dim);
+  for (i=0; i<dim; i++)
+    {
+      li0->ve[i] = lmm-lp (&e[i], &e0);
+      l0j->ve[i] = lp (&e0, &e[i]);
+    }
+
+  for (t=0; t<s; t++)
+    for (j=0; j<dim; j++)
+      {
+        a = S[t] > j ? S[t] : j;
+        b = S[t] > j ? j : S[t];
+        L->me[a][b] = L->me[b][a] = li0->ve[a]-l0j->ve[b]+lp (&e[a], &e[b]);
+      }
+  V_FREE (li0);
+  V_FREE (l0j);
+  prof_add (PROF_FILL, t0);
+}
+
+/* Rows m0..m-1 of the calclp matrix of the first m elements of e,
+ * B->me[t][j] = L[m0+t][j] for j < m, to border a factored system with
+ * the new elements m0..m-1. About (m-m0)*m calls of lp().
+ */
+void calclp_border (MAT *B, element *e, element e0, int m0, int m)
+{
+  int j, t, a, b;
+  double lmm;
+  VEC *li0, *l0j;
+  uint64_t t0;
+
+  t0 = prof_begin ();
+  if (IMAGE_GROUND (e0))
+    {
+      for (t=0; t<m-m0; t++)
+        for (j=0; j<m; j++)
+          {
+            a = m0+t > j ? m0+t : j;
+            b = m0+t > j ? j : m0+t;
+            B->me[t][j] = lp_image (&e[a], &e[b], e0);
+          }
+      prof_add (PROF_FILL, t0);
+      return;
+    }
+
+  lmm = lp (&e0, &e0);
+  li0 = v_get (m);
+  l0j = v_get (m);
+  for (j=0; j<m; j++)
+    {
+      li0->ve[j] = lmm-lp (&e[j], &e0);
+      l0j->ve[j] = lp (&e0, &e[j]);
+    }
+
+  for (t=0; t<m-m0; t++)
+    for (j=0; j<m; j++)
+      {
+        a = m0+t > j ? m0+t : j;
+        b = m0+t > j ? j : m0+t;
+        B->me[t][j] = li0->ve[a]-l0j->ve[b]+lp (&e[a], &e[b]);
+      }
+  V_FREE (li0);
+  V_FREE (l0j);
+  prof_add (PROF_FILL, t0);
+}
+
+/* Resistance of signal element ei, with the same conductor and
+ * dielectric loss terms as calcl
+ */
+double calc_element_loss (element *ei, double Omega, conductor *cond, int N)
+{
+  double sigma=SIGMA_COPPER;
+  double conductor_loss = 1/(sigma*(ei->x2-ei->x1)*(ei->y2-ei->y1));
+
+  if (cond != NULL && N > 0 && cond[1].substrate_h > 0.0)
+    conductor_loss += calc_dielectric_loss(cond[1].er, cond[1].tan_delta,
+                                           Omega, cond[1].w,
+                                           cond[1].substrate_h);
+  return conductor_loss;
+}
+
+/* Assemble Z = R + jwL from a matrix filled by calclp. L is only read,
+ * so several threads may assemble their own Z from one shared L.
+ */
+void calcz (ZMAT *Z, const MAT *L, element *e, int n0, double Omega,
+            element e0, conductor *cond, int N)
+{
+  int i, j;
+  int dim;
+  double r00;
+  uint64_t t;
+  dim = Z->m;
+  t = prof_begin ();
+
+  r00 = calc_r00 (e0, Omega, cond);
+  for (i=0; i<dim; i++)
+    for (j=0; j<dim; j++)
+      {
+        Z->me[i][j].im = Omega * L->me[i][j];
+        Z->me[i][j].re = r00;
+      }
+
+  for (i=n0; i<dim; i++)
+    Z->me[i][i].re += calc_element_loss (&e[i], Omega, cond, N);
+  prof_add (PROF_ASSEMBLE, t);
+}
@@ -0,0 +1,142 @@
+/* client.c - send decks to weeks-server
+ *
+ *   weeks-client [-s socket] [deck.yaml ...]
+ *
+ * Each deck (standard input without any) is one request; the answer is
+ * copied to standard output and the round trip time to standard error.
+ * The exit status is 1 if any request failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_SOCKET "/tmp/weeks.sock"
+
+static double now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec+1e-6*tv.tv_usec;
+}
+
+static int write_all (int fd, const char *b, size_t n)
+{
+  ssize_t w;
+
+  while (n > 0)
+    {
+      w = write (fd, b, n);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return 0;
+      b += w;
+      n -= w;
+    }
+  return 1;
+}
+
+/* Send one deck. Returns 1 if the server solved it. */
+static int request (const char *path, FILE *deck, const char *name)
+{
+  struct sockaddr_un addr;
+  char buf[65536], tail[256];
+  size_t n, t;
+  ssize_t r;
+  double t0;
+  int fd;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strncpy (addr.sun_path, path, sizeof (addr.sun_path)-1);
+  if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      fprintf (stderr, "ERROR: Can not connect to %s: %s\n", path,
+               strerror (errno));
+      exit (EXIT_FAILURE);
+    }
+
+  t0 = now ();
+  while ((n = fread (buf, 1, sizeof (buf), deck)) > 0)
+    if (!write_all (fd, buf, n))
+      break;
+  shutdown (fd, SHUT_WR);
+
+  /* Copy the answer, keeping its end for the status */
+  t = 0;
+  while ((r = read (fd, buf, sizeof (buf))) != 0)
+    {
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r < 0)
+        {
+          fprintf (stderr, "ERROR: Can not read the answer to %s: %s\n", name,
+                   strerror (errno));
+          close (fd);
+          return 0;
+        }
+      n = r;
+      fwrite (buf, 1, n, stdout);
+      if (n >= sizeof (tail)-1)
+        {
+          memcpy (tail, buf+n-(sizeof (tail)-1), sizeof (tail)-1);
+          t = sizeof (tail)-1;
+        }
+      else
+        {
+          if (t+n > sizeof (tail)-1)
+            {
+              memmove (tail, tail+t+n-(sizeof (tail)-1),
+                       sizeof (tail)-1-n);
+              t = sizeof (tail)-1-n;
+            }
+          memcpy (tail+t, buf, n);
+          t += n;
+        }
+    }
+  tail[t] = '\0';
+  close (fd);
+  fprintf (stderr, "%s: round trip %.1f ms\n", name, 1e3*(now ()-t0));
+  return strstr (tail, "status=ok") != NULL;
+}
+
+int main (int argc, char **argv)
+{
+  const char *path;
+  FILE *fp;
+  int c, i, ok;
+
+  path = SERVER_SOCKET;
+  while ((c = getopt (argc, argv, "s:")) != -1)
+    if (c == 's')
+      path = optarg;
+    else
+      {
+        fprintf (stderr, "Usage: weeks-client [-s socket] [deck.yaml ...]\n");
+        exit (EXIT_FAILURE);
+      }
+
+  if (optind == argc)
+    return !request (path, stdin, "stdin");
+  ok = 1;
+  for (i=optind;i<argc;i++)
+    {
+      if ((fp = fopen (argv[i], "r")) == NULL)
+        {
+          fprintf (stderr, "ERROR: Can not open %s\n", argv[i]);
+          ok = 0;
+          continue;
+        }
+      ok &= request (path, fp, argv[i]);
+      fclose (fp);
+    }
+  return !ok;
+}
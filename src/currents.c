@@ -0,0 +1,199 @@
+/* currents.c - element current density export
+ *
+ * Writes the current density of every element for each port solution
+ * of a solve: column k of the M x N matrix X from port_solutions (or
+ * sym_solutions) divided by the element area, i.e. the density for one
+ * volt per metre on signal line k+1 and none on the others. The
+ * reference element e0 carries the return current, minus the sum of the
+ * others, and is written as well unless it is the surface of an ideal
+ * ground.
+ *
+ * CSV has one row per element and frequency:
+ *
+ *   frequency,element,conductor,x1,x2,y1,y2,J1_re,J1_im,...,JN_re,JN_im
+ *
+ * The binary format is native-endian: the header "WKJ1" and int32 N,
+ * then for each frequency a double f and int32 count, followed by count
+ * records of int32 conductor, double x1, x2, y1, y2 and N complex
+ * densities (2N doubles).
+ *
+ * The stream belongs to one run (weeks_ctx.cur) and is written by the
+ * thread that reports its results, one frequency point at a time in
+ * frequency order. A failed write (a full disk) stops the export and
+ * makes cur_close, and so the run, fail.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "currents.h"
+#include "mf.h"
+
+#define CUR_BUFFER (1 << 20)
+
+struct cur_stream {
+  FILE *fp;
+  char file[256];
+  int format, N;
+  int failed;                   /* a write failed, nothing more is written */
+};
+
+/* Open file for N port solutions. Returns NULL if it can not be
+ * written.
+ */
+cur_stream *cur_open (const char *file, int format, int N)
+{
+  cur_stream *c;
+  FILE *fp;
+  int32_t n;
+
+  fp = fopen (file, format == CURRENT_BINARY ? "wb" : "w");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "\nERROR: Can not write %s", file);
+      return NULL;
+    }
+  setvbuf (fp, NULL, _IOFBF, CUR_BUFFER);
+  c = (cur_stream *) Malloc (sizeof (cur_stream));
+  c->fp = fp;
+  snprintf (c->file, sizeof (c->file), "%s", file);
+  c->format = format;
+  c->N = N;
+  c->failed = 0;
+  if (format == CURRENT_BINARY)
+    {
+      n = N;
+      fwrite ("WKJ1", 1, 4, fp);
+      fwrite (&n, sizeof (n), 1, fp);
+    }
+  else
+    {
+      fprintf (fp, "frequency,element,conductor,x1,x2,y1,y2");
+      for (n=1;n<=N;n++)
+        fprintf (fp, ",J%d_re,J%d_im", (int) n, (int) n);
+      fprintf (fp, "\n");
+    }
+  fprintf (stderr, "\nWriting element current densities to %s", file);
+  return c;
+}
+
+/* Signal line of element i, 0 for the ground plane */
+static int cur_owner (int i, int n0, conductor *cond, int N)
+{
+  int k;
+
+  if (i < n0)
+    return 0;
+  i -= n0;
+  for (k=1;k<=N;k++)
+    {
+      if (i < cond[k].n)
+        return k;
+      i -= cond[k].n;
+    }
+  return 0;
+}
+
+/* Returns 0 if the record could not be written */
+static int cur_record (cur_stream *c, const element *el, int index,
+                       int owner, const complex *x, double f)
+{
+  double area, rec[4];
+  complex j[MAX_CONDUCTORS];
+  int32_t o;
+  int k;
+
+  area = (el->x2-el->x1)*(el->y2-el->y1);
+  if (c->format == CURRENT_BINARY)
+    {
+      o = owner;
+      rec[0] = el->x1;
+      rec[1] = el->x2;
+      rec[2] = el->y1;
+      rec[3] = el->y2;
+      for (k=0;k<c->N;k++)
+        {
+          j[k].re = x[k].re/area;
+          j[k].im = x[k].im/area;
+        }
+      return fwrite (&o, sizeof (o), 1, c->fp) == 1 &&
+             fwrite (rec, sizeof (double), 4, c->fp) == 4 &&
+             fwrite (j, sizeof (complex), c->N, c->fp) == (size_t) c->N;
+    }
+  fprintf (c->fp, "%.6e,%d,%d,%.9e,%.9e,%.9e,%.9e", f, index, owner,
+           el->x1, el->x2, el->y1, el->y2);
+  for (k=0;k<c->N;k++)
+    fprintf (c->fp, ",%.6e,%.6e", x[k].re/area, x[k].im/area);
+  return fprintf (c->fp, "\n") > 0 && !ferror (c->fp);
+}
+
+static void cur_failed (cur_stream *c)
+{
+  if (!c->failed)
+    fprintf (stderr, "\nERROR: Can not write %s (disk full?)", c->file);
+  c->failed = 1;
+}
+
+/* Write the port solutions X (M x N) of the mesh e at frequency f.
+ * e0 is written as element M.
+ */
+void cur_write (cur_stream *c, const ZMAT *X, element *e, element e0,
+                int n0, conductor *cond, int N, double f)
+{
+  complex x0[MAX_CONDUCTORS];
+  double fd;
+  int32_t count;
+  int i, k, M;
+
+  if (c == NULL || c->failed)
+    return;
+  M = X->m;
+  count = M + !IMAGE_GROUND (e0);
+  if (c->format == CURRENT_BINARY)
+    {
+      fd = f;
+      if (fwrite (&fd, sizeof (fd), 1, c->fp) != 1 ||
+          fwrite (&count, sizeof (count), 1, c->fp) != 1)
+        {
+          cur_failed (c);
+          return;
+        }
+    }
+  for (i=0;i<M;i++)
+    if (!cur_record (c, &e[i], i, cur_owner (i, n0, cond, N), X->me[i], f))
+      {
+        cur_failed (c);
+        return;
+      }
+
+  /* The return through e0 closes the sum of the element currents */
+  if (!IMAGE_GROUND (e0))
+    {
+      for (k=0;k<N;k++)
+        {
+          x0[k].re = x0[k].im = 0.0;
+          for (i=0;i<M;i++)
+            {
+              x0[k].re -= X->me[i][k].re;
+              x0[k].im -= X->me[i][k].im;
+            }
+        }
+      if (!cur_record (c, &e0, M, 0, x0, f))
+        cur_failed (c);
+    }
+}
+
+/* Close the export. Returns 0 if any of it could not be written. */
+int cur_close (cur_stream *c)
+{
+  int ok;
+
+  if (c == NULL)
+    return 1;
+  if (fclose (c->fp) != 0)
+    cur_failed (c);
+  ok = !c->failed;
+  Free (c);
+  return ok;
+}
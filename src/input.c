@@ -1,10 +1,58 @@
 /* input.c - YAML input parser for WEEKS calculator
  * 
- * Reads conductor configuration from YAML files
+ * Reads conductor configuration and settings (into a weeks_ctx) from YAML files
  * Requires: libyaml (libyaml-dev package on Ubuntu/Debian)
  * 
  * YAML format:
  * frequency: 30e6
+ * frequencies: [1e6, 10e6, 100e6]   (optional sweep, replaces frequency)
+ * threads: 4                        (optional, sweep workers)
+ * memory_budget: 2e9                (optional, bytes for sweep workers)
+ * mesh: auto                        (optional, fixed|auto, per conductor too)
+ * adapt: yes                        (optional, h-adaptive refinement)
+ * adapt_tolerance: 0.1              (optional, relative current density jump)
+ * adapt_threshold: 1e-3             (optional, relative R/L change to stop)
+ * adapt_iterations: 8               (optional, maximum refinement passes)
+ * progressive: 3                    (optional, coarse-to-fine mesh levels)
+ * progressive_tolerance: 1e-2       (optional, extrapolated error to stop)
+ * shell: auto                       (optional, off|auto|on surface shell mesh)
+ * shell_frequency: 1e9              (optional, lowest frequency for auto shell)
+ * shell_depth: 3                    (optional, shell depth in skin depths)
+ * shell_check: yes                  (optional, compare with the volume mesh)
+ * symmetry: auto                     (optional, auto|off mirror decomposition)
+ * incremental: yes                  (optional, add conductors one at a time)
+ * sweep_mode: cartesian             (optional, cartesian|zip)
+ * sweep:                            (optional, parametric geometry sweep)
+ *   - conductor: line2
+ *     field: x                      (x, y, w or h)
+ *     values: [825e-6, 850e-6]      (or from/to/steps)
+ * samples: 1000                     (optional, Monte Carlo tolerance run)
+ * seed: 1                           (optional, random seed)
+ * samples_file: mc.csv              (optional, raw samples as CSV)
+ * tolerances:
+ *   - conductor: all                (or line1, ...)
+ *     field: w                      (x, y, w or h)
+ *     sigma: 5e-6
+ *     distribution: normal          (normal|uniform)
+ * port_groups:                      (optional, extra port definitions)
+ *   - name: pair
+ *     ports: [line1, line2]         (conductors joined by '+' share a port)
+ *     reference: line0              (default line0, may be line0+line3)
+ * current_file: currents.csv        (optional, element current densities)
+ * current_format: csv               (optional, csv|binary)
+ * out_of_core: auto                 (optional, off|auto|on Z on disk)
+ * ooc_dir: /scratch                 (optional, directory for the Z file)
+ * ooc_panel: 512                    (optional, panel width, 0 = from budget)
+ * lp_cache: /var/tmp/weeks-lp       (optional, keep Lp matrices on disk)
+ * lp_cache_size: 4e9                (optional, bytes, default 1e9, 0 = no limit)
+ * result_cache: /var/tmp/weeks-res  (optional, reuse results of identical runs)
+ * profile_file: runs.json          (optional, append phase timings per run)
+ * hw_counters: yes                  (optional, cycles and cache misses per phase)
+ * ground_mesh: graded               (optional, uniform|graded|image ground)
+ * ground_min: 20e-6                 (optional, column width under the lines)
+ * ground_max: 500e-6                (optional, widest graded column)
+ * ground_grade: 0.5                 (optional, width growth per unit distance)
+ * ground_check: yes                 (optional, compare image with meshed ground)
  * conductors:
  *   - name: line0
  *     w: 2800e-6
@@ -19,10 +67,65 @@
 #include "weeks.h"
 #include "mf.h"
 
-#define MAX_CONDUCTORS 10
+/* Defaults of every setting, before the input file is read */
+void weeks_defaults(weeks_ctx *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->frequency = 30e6;       /* Default 30 MHz */
+    ctx->mesh = MESH_FIXED;
+    ctx->adapt_tolerance = 0.1;
+    ctx->adapt_threshold = 1e-3;
+    ctx->adapt_iterations = 8;
+    ctx->progressive_tolerance = 1e-2;
+    ctx->shell = SHELL_AUTO;
+    ctx->shell_frequency = 1e9;
+    ctx->shell_depth = 3.0;
+    ctx->symmetry = 1;
+    ctx->seed = 1;
+    ctx->current_format = CURRENT_CSV;
+    ctx->out_of_core = OOC_AUTO;
+    strcpy(ctx->ooc_dir, "/tmp");
+    ctx->lp_cache_size = 1e9;
+    ctx->ground_mesh = GROUND_UNIFORM;
+    ctx->ground_grade = 0.5;
+    ctx->out = stdout;
+}
+
+/* Parse a shell mode keyword */
+static int parse_shell(const char *value) {
+    if (strcmp(value, "auto") == 0)
+        return SHELL_AUTO;
+    if (strcmp(value, "on") == 0 || strcmp(value, "yes") == 0)
+        return SHELL_ON;
+    if (strcmp(value, "off") != 0 && strcmp(value, "no") != 0)
+        fprintf(stderr, "\nWARNING: unknown shell mode '%s', using off", value);
+    return SHELL_OFF;
+}
+
+/* Parse a ground plane mesh keyword */
+static int parse_ground(const char *value) {
+    if (strcmp(value, "graded") == 0)
+        return GROUND_GRADED;
+    if (strcmp(value, "image") == 0)
+        return GROUND_IMAGE;
+    if (strcmp(value, "uniform") != 0)
+        fprintf(stderr, "\nWARNING: unknown ground mesh '%s', using uniform", value);
+    return GROUND_UNIFORM;
+}
+
+/* Parse a yes/no value */
+static int parse_bool(const char *value) {
+    return strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 ||
+           strcmp(value, "on") == 0 || strcmp(value, "1") == 0;
+}
 
-/* Global frequency variable */
-double global_frequency = 30e6;  /* Default 30 MHz */
+/* Parse a mesh mode keyword */
+static int parse_mesh(const char *value) {
+    if (strcmp(value, "auto") == 0)
+        return MESH_AUTO;
+    if (strcmp(value, "fixed") != 0)
+        fprintf(stderr, "\nWARNING: unknown mesh mode '%s', using fixed", value);
+    return MESH_FIXED;
+}
 
 /* Helper function to get scalar value from YAML */
 static char* get_scalar_value(yaml_event_t *event) {
@@ -32,6 +135,322 @@ static char* get_scalar_value(yaml_event_t *event) {
     return strdup((char*)event->data.scalar.value);
 }
 
+/* Parse a sweep field name, -1 if unknown */
+static int parse_field(const char *value) {
+    if (strcmp(value, "x") == 0)
+        return SWEEP_X;
+    if (strcmp(value, "y") == 0)
+        return SWEEP_Y;
+    if (strcmp(value, "w") == 0)
+        return SWEEP_W;
+    if (strcmp(value, "h") == 0)
+        return SWEEP_H;
+    fprintf(stderr, "\nERROR: can not vary field '%s' (x, y, w or h)", value);
+    return -1;
+}
+
+/* Name of a SWEEP_* field, as parse_field reads it */
+const char *field_name(int field) {
+    static const char *name[] = { "x", "y", "w", "h" };
+
+    return name[field];
+}
+
+/* Parse one sweep parameter from YAML. Returns 1 if it is usable, 0
+ * (after saying why) if the deck must be rejected.
+ */
+static int parse_sweep_param(yaml_parser_t *parser, sweep_param *p) {
+    yaml_event_t event;
+    char *key = NULL;
+    int in_mapping = 1;
+    int in_values = 0;
+    int steps = 0;
+    int values = 0;
+    int bad = 0;
+    double from = 0.0, to = 0.0;
+    int i;
+    
+    p->cond = -1;
+    p->field = -1;
+    p->n = 0;
+    
+    while (in_mapping) {
+        if (!yaml_parser_parse(parser, &event)) {
+            fprintf(stderr, "YAML parse error\n");
+            return 0;
+        }
+        
+        switch (event.type) {
+            case YAML_MAPPING_END_EVENT:
+                in_mapping = 0;
+                break;
+                
+            case YAML_SEQUENCE_START_EVENT:
+                if (key && strcmp(key, "values") == 0)
+                    in_values = 1;
+                break;
+                
+            case YAML_SEQUENCE_END_EVENT:
+                in_values = 0;
+                free(key);
+                key = NULL;
+                break;
+                
+            case YAML_SCALAR_EVENT:
+                if (in_values) {
+                    char *value = get_scalar_value(&event);
+                    if (p->n < MAX_SWEEP_VALUES)
+                        p->v[p->n++] = atof(value);
+                    values++;
+                    free(value);
+                } else if (key == NULL) {
+                    key = get_scalar_value(&event);
+                } else {
+                    char *value = get_scalar_value(&event);
+                    
+                    if (strcmp(key, "conductor") == 0) {
+                        /* line2 or just 2 */
+                        p->cond = atoi(strncmp(value, "line", 4) == 0 ?
+                                       value+4 : value);
+                    } else if (strcmp(key, "field") == 0) {
+                        p->field = parse_field(value);
+                        bad |= p->field < 0;
+                    } else if (strcmp(key, "from") == 0) {
+                        from = atof(value);
+                    } else if (strcmp(key, "to") == 0) {
+                        to = atof(value);
+                    } else if (strcmp(key, "steps") == 0) {
+                        steps = atoi(value);
+                    }
+                    
+                    free(value);
+                    free(key);
+                    key = NULL;
+                }
+                break;
+                
+            default:
+                break;
+        }
+        
+        yaml_event_delete(&event);
+    }
+    
+    /* from/to/steps gives evenly spaced values */
+    if (p->n == 0 && steps > 0 && steps <= MAX_SWEEP_VALUES) {
+        for (i = 0; i < steps; i++)
+            p->v[i] = steps > 1 ? from + (to-from)*i/(steps-1) : from;
+        p->n = steps;
+    }
+    
+    if (p->cond < 0) {
+        fprintf(stderr, "\nERROR: sweep parameter without a conductor");
+        return 0;
+    }
+    if (p->field < 0) {
+        if (!bad)
+            fprintf(stderr, "\nERROR: sweep of line%d without a field", p->cond);
+        return 0;
+    }
+    if (values > MAX_SWEEP_VALUES || steps > MAX_SWEEP_VALUES) {
+        fprintf(stderr, "\nERROR: sweep of line%d has more than %d values",
+                p->cond, MAX_SWEEP_VALUES);
+        return 0;
+    }
+    if (p->n == 0) {
+        fprintf(stderr, "\nERROR: sweep of line%d has no values", p->cond);
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse one tolerance from YAML. Returns 1 if it is usable, 0 (after
+ * saying why) if the deck must be rejected.
+ */
+static int parse_tolerance(yaml_parser_t *parser, tolerance *t) {
+    yaml_event_t event;
+    char *key = NULL;
+    int in_mapping = 1;
+    int bad = 0;
+    
+    t->cond = -1;
+    t->field = -1;
+    t->dist = DIST_NORMAL;
+    t->sigma = 0.0;
+    
+    while (in_mapping) {
+        if (!yaml_parser_parse(parser, &event)) {
+            fprintf(stderr, "YAML parse error\n");
+            return 0;
+        }
+        
+        switch (event.type) {
+            case YAML_MAPPING_END_EVENT:
+                in_mapping = 0;
+                break;
+                
+            case YAML_SCALAR_EVENT:
+                if (key == NULL) {
+                    key = get_scalar_value(&event);
+                } else {
+                    char *value = get_scalar_value(&event);
+                    
+                    if (strcmp(key, "conductor") == 0) {
+                        if (strcmp(value, "all") == 0)
+                            t->cond = -1;
+                        else
+                            t->cond = atoi(strncmp(value, "line", 4) == 0 ?
+                                           value+4 : value);
+                    } else if (strcmp(key, "field") == 0) {
+                        t->field = parse_field(value);
+                        bad |= t->field < 0;
+                    } else if (strcmp(key, "sigma") == 0) {
+                        t->sigma = atof(value);
+                    } else if (strcmp(key, "distribution") == 0) {
+                        if (strcmp(value, "uniform") == 0)
+                            t->dist = DIST_UNIFORM;
+                        else if (strcmp(value, "normal") == 0)
+                            t->dist = DIST_NORMAL;
+                        else {
+                            fprintf(stderr, "\nERROR: unknown distribution '%s' (normal or uniform)",
+                                    value);
+                            bad = 1;
+                        }
+                    }
+                    
+                    free(value);
+                    free(key);
+                    key = NULL;
+                }
+                break;
+                
+            default:
+                break;
+        }
+        
+        yaml_event_delete(&event);
+    }
+    
+    if (bad)
+        return 0;
+    if (t->field < 0) {
+        fprintf(stderr, "\nERROR: tolerance without a field");
+        return 0;
+    }
+    if (!(t->sigma > 0.0)) {
+        fprintf(stderr, "\nERROR: tolerance sigma must be positive");
+        return 0;
+    }
+    return 1;
+}
+
+/* Put the conductors of a '+' separated list such as line1+line3 in
+ * port p of g. Returns 0 for a conductor that does not exist.
+ */
+static int parse_port_list(const char *value, port_group *g, int p) {
+    char buf[256], *tok, *num, *end;
+    int c, ok = 1;
+    
+    strncpy(buf, value, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+    for (tok = strtok(buf, "+ "); tok; tok = strtok(NULL, "+ ")) {
+        num = strncmp(tok, "line", 4) == 0 ? tok+4 : tok;
+        c = (int) strtol(num, &end, 10);
+        if (end == num || *end != '\0' || c < 0 || c >= MAX_CONDUCTORS) {
+            fprintf(stderr, "\nERROR: no conductor '%s' in port group", tok);
+            ok = 0;
+        } else
+            g->port[c] = p;
+    }
+    return ok;
+}
+
+/* Parse one port grouping from YAML. Returns 1 if it is usable, 0
+ * (after saying why) if the deck must be rejected.
+ */
+static int parse_port_group(yaml_parser_t *parser, port_group *g, int index) {
+    yaml_event_t event;
+    char *key = NULL;
+    int in_mapping = 1;
+    int in_ports = 0;
+    int has_reference = 0;
+    int ok = 1;
+    int i;
+    
+    snprintf(g->name, sizeof(g->name), "group%d", index+1);
+    g->nport = 0;
+    for (i = 0; i < MAX_CONDUCTORS; i++)
+        g->port[i] = PORT_FLOATING;
+    
+    while (in_mapping) {
+        if (!yaml_parser_parse(parser, &event)) {
+            fprintf(stderr, "YAML parse error\n");
+            return 0;
+        }
+        
+        switch (event.type) {
+            case YAML_MAPPING_END_EVENT:
+                in_mapping = 0;
+                break;
+                
+            case YAML_SEQUENCE_START_EVENT:
+                if (key && strcmp(key, "ports") == 0)
+                    in_ports = 1;
+                break;
+                
+            case YAML_SEQUENCE_END_EVENT:
+                in_ports = 0;
+                free(key);
+                key = NULL;
+                break;
+                
+            case YAML_SCALAR_EVENT:
+                if (in_ports) {
+                    char *value = get_scalar_value(&event);
+                    g->nport++;
+                    ok &= parse_port_list(value, g, g->nport);
+                    free(value);
+                } else if (key == NULL) {
+                    key = get_scalar_value(&event);
+                } else {
+                    char *value = get_scalar_value(&event);
+                    
+                    if (strcmp(key, "name") == 0) {
+                        strncpy(g->name, value, sizeof(g->name)-1);
+                        g->name[sizeof(g->name)-1] = '\0';
+                    } else if (strcmp(key, "reference") == 0) {
+                        ok &= parse_port_list(value, g, PORT_REFERENCE);
+                        has_reference = 1;
+                    }
+                    
+                    free(value);
+                    free(key);
+                    key = NULL;
+                }
+                break;
+                
+            default:
+                break;
+        }
+        
+        yaml_event_delete(&event);
+    }
+    
+    if (!has_reference && g->port[0] == PORT_FLOATING)
+        g->port[0] = PORT_REFERENCE;
+    for (i = 0; i < MAX_CONDUCTORS && g->port[i] != PORT_REFERENCE; i++)
+        ;
+    if (i == MAX_CONDUCTORS) {
+        fprintf(stderr, "\nERROR: port group '%s' has no reference", g->name);
+        ok = 0;
+    }
+    if (g->nport == 0) {
+        fprintf(stderr, "\nERROR: port group '%s' has no ports", g->name);
+        ok = 0;
+    }
+    return ok;
+}
+
 /* Parse a conductor from YAML */
 static int parse_conductor(yaml_parser_t *parser, conductor *c) {
     yaml_event_t event;
@@ -49,6 +468,9 @@ static int parse_conductor(yaml_parser_t *parser, conductor *c) {
     c->er = 1.0;
     c->substrate_h = 0.0;
     c->tan_delta = 0.0;
+    c->mesh = MESH_DEFAULT;
+    c->shell = 0.0;
+    c->gmin = c->gmax = c->grade = 0.0;
     
     while (in_mapping) {
         if (!yaml_parser_parse(parser, &event)) {
@@ -91,6 +513,8 @@ static int parse_conductor(yaml_parser_t *parser, conductor *c) {
                         c->substrate_h = atof(value);
                     } else if (strcmp(key, "tan_delta") == 0) {
                         c->tan_delta = atof(value);
+                    } else if (strcmp(key, "mesh") == 0) {
+                        c->mesh = parse_mesh(value);
                     }
                     
                     free(value);
@@ -114,12 +538,17 @@ static int parse_conductor(yaml_parser_t *parser, conductor *c) {
     return 1;
 }
 
-conductor *getinput(FILE *fp, int *n) {
+conductor *getinput(FILE *fp, weeks_ctx *ctx, int *n) {
     yaml_parser_t parser;
     yaml_event_t event;
     conductor *conductors;
     int conductor_count = 0;
     int in_conductors_sequence = 0;
+    int in_frequencies_sequence = 0;
+    int in_sweep_sequence = 0;
+    int in_tolerance_sequence = 0;
+    int in_group_sequence = 0;
+    int bad = 0;
     char *key = NULL;
     
     conductors = (conductor *)Malloc(sizeof(conductor) * MAX_CONDUCTORS);
@@ -149,7 +578,13 @@ conductor *getinput(FILE *fp, int *n) {
                 break;
                 
             case YAML_SCALAR_EVENT:
-                if (!in_conductors_sequence) {
+                if (in_frequencies_sequence) {
+                    char *value = get_scalar_value(&event);
+                    if (ctx->nfreq < MAX_FREQUENCIES)
+                        ctx->frequencies[ctx->nfreq++] = atof(value);
+                    free(value);
+                } else if (!in_conductors_sequence && !in_sweep_sequence &&
+                           !in_tolerance_sequence && !in_group_sequence) {
                     if (key == NULL) {
                         key = get_scalar_value(&event);
                     } else {
@@ -157,9 +592,88 @@ conductor *getinput(FILE *fp, int *n) {
                         char *value = get_scalar_value(&event);
                         
                         if (strcmp(key, "frequency") == 0) {
-                            global_frequency = atof(value);
+                            ctx->frequency = atof(value);
                             fprintf(stderr, "\nFrequency: %.2e Hz (%.2f MHz)",
-                                    global_frequency, global_frequency/1e6);
+                                    ctx->frequency, ctx->frequency/1e6);
+                        } else if (strcmp(key, "threads") == 0) {
+                            ctx->threads = atoi(value);
+                        } else if (strcmp(key, "memory_budget") == 0) {
+                            ctx->memory_budget = atof(value);
+                        } else if (strcmp(key, "mesh") == 0) {
+                            ctx->mesh = parse_mesh(value);
+                        } else if (strcmp(key, "adapt") == 0) {
+                            ctx->adapt = parse_bool(value);
+                        } else if (strcmp(key, "adapt_tolerance") == 0) {
+                            ctx->adapt_tolerance = atof(value);
+                        } else if (strcmp(key, "adapt_threshold") == 0) {
+                            ctx->adapt_threshold = atof(value);
+                        } else if (strcmp(key, "adapt_iterations") == 0) {
+                            ctx->adapt_iterations = atoi(value);
+                        } else if (strcmp(key, "progressive") == 0) {
+                            ctx->progressive = atoi(value);
+                        } else if (strcmp(key, "progressive_tolerance") == 0) {
+                            ctx->progressive_tolerance = atof(value);
+                        } else if (strcmp(key, "shell") == 0) {
+                            ctx->shell = parse_shell(value);
+                        } else if (strcmp(key, "shell_frequency") == 0) {
+                            ctx->shell_frequency = atof(value);
+                        } else if (strcmp(key, "shell_depth") == 0) {
+                            ctx->shell_depth = atof(value);
+                        } else if (strcmp(key, "shell_check") == 0) {
+                            ctx->shell_check = parse_bool(value);
+                        } else if (strcmp(key, "symmetry") == 0) {
+                            ctx->symmetry = strcmp(value, "off") != 0 &&
+                                           strcmp(value, "no") != 0;
+                        } else if (strcmp(key, "samples") == 0) {
+                            ctx->samples = atoi(value);
+                        } else if (strcmp(key, "seed") == 0) {
+                            ctx->seed = strtoul(value, NULL, 10);
+                        } else if (strcmp(key, "samples_file") == 0) {
+                            strncpy(ctx->samples_file, value,
+                                    sizeof(ctx->samples_file)-1);
+                        } else if (strcmp(key, "current_file") == 0) {
+                            strncpy(ctx->current_file, value,
+                                    sizeof(ctx->current_file)-1);
+                        } else if (strcmp(key, "current_format") == 0) {
+                            ctx->current_format =
+                                strcmp(value, "binary") == 0 ?
+                                CURRENT_BINARY : CURRENT_CSV;
+                        } else if (strcmp(key, "out_of_core") == 0) {
+                            ctx->out_of_core =
+                                strcmp(value, "auto") == 0 ? OOC_AUTO :
+                                parse_bool(value) ? OOC_ON : OOC_OFF;
+                        } else if (strcmp(key, "ooc_dir") == 0) {
+                            strncpy(ctx->ooc_dir, value,
+                                    sizeof(ctx->ooc_dir)-1);
+                        } else if (strcmp(key, "ooc_panel") == 0) {
+                            ctx->ooc_panel = atoi(value);
+                        } else if (strcmp(key, "lp_cache") == 0) {
+                            strncpy(ctx->lp_cache, value,
+                                    sizeof(ctx->lp_cache)-1);
+                        } else if (strcmp(key, "lp_cache_size") == 0) {
+                            ctx->lp_cache_size = atof(value);
+                        } else if (strcmp(key, "result_cache") == 0) {
+                            strncpy(ctx->result_cache, value,
+                                    sizeof(ctx->result_cache)-1);
+                        } else if (strcmp(key, "profile_file") == 0) {
+                            strncpy(ctx->profile_file, value,
+                                    sizeof(ctx->profile_file)-1);
+                        } else if (strcmp(key, "hw_counters") == 0) {
+                            ctx->hw_counters = parse_bool(value);
+                        } else if (strcmp(key, "sweep_mode") == 0) {
+                            ctx->sweep_zip = strcmp(value, "zip") == 0;
+                        } else if (strcmp(key, "incremental") == 0) {
+                            ctx->incremental = parse_bool(value);
+                        } else if (strcmp(key, "ground_mesh") == 0) {
+                            ctx->ground_mesh = parse_ground(value);
+                        } else if (strcmp(key, "ground_min") == 0) {
+                            ctx->ground_min = atof(value);
+                        } else if (strcmp(key, "ground_max") == 0) {
+                            ctx->ground_max = atof(value);
+                        } else if (strcmp(key, "ground_grade") == 0) {
+                            ctx->ground_grade = atof(value);
+                        } else if (strcmp(key, "ground_check") == 0) {
+                            ctx->ground_check = parse_bool(value);
                         }
                         
                         free(value);
@@ -174,11 +688,35 @@ conductor *getinput(FILE *fp, int *n) {
                     in_conductors_sequence = 1;
                     free(key);
                     key = NULL;
+                } else if (key && strcmp(key, "tolerances") == 0) {
+                    in_tolerance_sequence = 1;
+                    ctx->ntol = 0;
+                    free(key);
+                    key = NULL;
+                } else if (key && strcmp(key, "port_groups") == 0) {
+                    in_group_sequence = 1;
+                    ctx->ngroups = 0;
+                    free(key);
+                    key = NULL;
+                } else if (key && strcmp(key, "sweep") == 0) {
+                    in_sweep_sequence = 1;
+                    ctx->nsweep = 0;
+                    free(key);
+                    key = NULL;
+                } else if (key && strcmp(key, "frequencies") == 0) {
+                    in_frequencies_sequence = 1;
+                    ctx->nfreq = 0;
+                    free(key);
+                    key = NULL;
                 }
                 break;
                 
             case YAML_SEQUENCE_END_EVENT:
                 in_conductors_sequence = 0;
+                in_frequencies_sequence = 0;
+                in_sweep_sequence = 0;
+                in_tolerance_sequence = 0;
+                in_group_sequence = 0;
                 break;
                 
             case YAML_MAPPING_START_EVENT:
@@ -188,6 +726,36 @@ conductor *getinput(FILE *fp, int *n) {
                             conductor_count++;
                         }
                     }
+                } else if (in_tolerance_sequence) {
+                    if (ctx->ntol == MAX_TOLERANCES) {
+                        fprintf(stderr, "\nERROR: more than %d tolerances",
+                                MAX_TOLERANCES);
+                        bad = 1;
+                    } else if (parse_tolerance(&parser, &ctx->tol[ctx->ntol]))
+                        ctx->ntol++;
+                    else
+                        bad = 1;
+                } else if (in_group_sequence) {
+                    if (ctx->ngroups == MAX_PORT_GROUPS) {
+                        fprintf(stderr, "\nERROR: more than %d port groups",
+                                MAX_PORT_GROUPS);
+                        bad = 1;
+                    } else if (parse_port_group(&parser,
+                                                &ctx->groups[ctx->ngroups],
+                                                ctx->ngroups))
+                        ctx->ngroups++;
+                    else
+                        bad = 1;
+                } else if (in_sweep_sequence) {
+                    if (ctx->nsweep == MAX_SWEEP_PARAMS) {
+                        fprintf(stderr, "\nERROR: more than %d sweep parameters",
+                                MAX_SWEEP_PARAMS);
+                        bad = 1;
+                    } else if (parse_sweep_param(&parser,
+                                                 &ctx->sweep[ctx->nsweep]))
+                        ctx->nsweep++;
+                    else
+                        bad = 1;
                 }
                 break;
                 
@@ -200,8 +768,27 @@ conductor *getinput(FILE *fp, int *n) {
     
     yaml_parser_delete(&parser);
     
+    /* A deck with a malformed entry is rejected, not run without it */
+    if (bad) {
+        fprintf(stderr, "\n");
+        Free(conductors);
+        return NULL;
+    }
+    
     *n = conductor_count;
     
+    if (ctx->nfreq > 0)
+        fprintf(stderr, "\nFrequency sweep: %d points from %.2e to %.2e Hz",
+                ctx->nfreq, ctx->frequencies[0],
+                ctx->frequencies[ctx->nfreq-1]);
+    if (ctx->samples > 0)
+        fprintf(stderr, "\nMonte Carlo: %d samples, %d tolerance(s)",
+                ctx->samples, ctx->ntol);
+    if (ctx->ngroups > 0)
+        fprintf(stderr, "\nPort groupings: %d", ctx->ngroups);
+    if (ctx->nsweep > 0)
+        fprintf(stderr, "\nGeometry sweep: %d parameter(s), %s",
+                ctx->nsweep, ctx->sweep_zip ? "zipped" : "cartesian");
     fprintf(stderr, "\n\nTotal conductors loaded: %d\n", conductor_count);
     
     return conductors;
@@ -0,0 +1,670 @@
+/* libweeks.c - the solver as a library
+ *
+ * Everything a run needs is in its weeks_ctx: the settings from the
+ * input and the open current density export. The geometry is passed
+ * in and the port impedances are handed to a report callback (or
+ * collected by weeks_solve), so several runs with their own contexts
+ * may go on at the same time from different threads of one process.
+ * What they do share is listed with weeks_ctx in weeks.h. A worker
+ * thread that can not be started leaves its work to the others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "ports.h"
+#include "currents.h"
+#include "ooc.h"
+#include "adapt.h"
+#include "progress.h"
+#include "border.h"
+#include "study.h"
+#include "montecarlo.h"
+#include "lpcache.h"
+#include "rescache.h"
+#include "prof.h"
+#include "libweeks.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+/* Mesh, fill and solve all frequency points on the mesh from test[].
+ * f is the highest frequency, used for adaptive refinement. Returns 0
+ * if the conductors could not be meshed or an out-of-core solve failed.
+ */
+static int solve (weeks_ctx *ctx, conductor *test, int N, double f,
+                  sweep_report report, void *arg)
+{
+  element *e, e0;
+  uint64_t t1;
+  int M,n0,workers,ok;
+  MAT *L;
+
+  fprintf(stderr, "\n\nBuilding partial elements...");
+  e = mesh_conductors (N, test, &e0, &M, &n0);
+  if (e == NULL)
+    return 0;
+  fprintf(stderr, "\nNumber of elements: %d", M);
+
+  t1 = prof_now ();
+  fprintf (stderr,"\n\nCalculating partial inductances with dielectric...");
+  if (ooc_needed (ctx, M))
+    {
+      ok = ooc_sweep (ctx, e, e0, M, n0, test, N, ctx->frequencies,
+                      ctx->nfreq, report, arg);
+      Free (e);
+      return ok;
+    }
+  if (ctx->incremental)
+    {
+      incremental (e, e0, n0, test, N, ctx->frequencies, ctx->nfreq,
+                   report, arg);
+      Free (e);
+      return 1;
+    }
+  if (!ctx->adapt)
+    {
+      sweep_mesh (ctx, e, e0, M, n0, test, N, ctx->frequencies, ctx->nfreq,
+                  report, arg);
+      Free (e);
+      return 1;
+    }
+
+  /* Frequency independent part, shared by all frequency points */
+  L = m_get (M,M);
+  calclp (L, e, e0);
+  fprintf (stderr, " -> %.3f seconds", 1e-9*(prof_now ()-t1));
+
+  e = adapt_mesh (ctx, e, e0, &M, &n0, test, N, f, &L);
+
+  workers = sweep_workers (sweep_shared (M), sweep_per_worker (M),
+                           ctx->nfreq, ctx->threads, ctx->memory_budget);
+  sweep (ctx, L, NULL, e, e0, n0, test, N, ctx->frequencies, ctx->nfreq,
+         workers, report, arg);
+
+  M_FREE (L);
+  Free (e);
+  return 1;
+}
+
+
+typedef struct {
+  ZMAT *z;
+} point_result;
+
+static void keep_result (ZMAT *z, ZMAT *y, double f, int N, void *arg)
+{
+  ((point_result *) arg)->z = z;
+}
+
+/* Port impedance of the mesh in test[] at a single frequency, NULL if
+ * it could not be meshed
+ */
+static ZMAT *solve_point (const weeks_ctx *ctx, conductor *test, int N,
+                          double f)
+{
+  element *e, e0;
+  int M, n0;
+  point_result r;
+
+  e = mesh_conductors (N, test, &e0, &M, &n0);
+  if (e == NULL)
+    return ZMNULL;
+  r.z = ZMNULL;
+  sweep_mesh (ctx, e, e0, M, n0, test, N, &f, 1, keep_result, &r);
+  Free (e);
+  return r.z;
+}
+
+/* Print the largest difference of za from the reference zb, relative
+ * to the diagonal of zb
+ */
+static void print_difference (const char *what, ZMAT *za, ZMAT *zb, int N)
+{
+  int i, j;
+  double dr, dl, d;
+
+  dr = dl = 0.0;
+  for (i=0;i<N;i++)
+    for (j=0;j<N;j++)
+      {
+        d = fabs (za->me[i][j].re-zb->me[i][j].re)/fabs (zb->me[i][i].re);
+        if (d > dr)
+          dr = d;
+        d = fabs (za->me[i][j].im-zb->me[i][j].im)/fabs (zb->me[i][i].im);
+        if (d > dl)
+          dl = d;
+      }
+  fprintf (stderr, "\n  %s: max R difference %.3e, max L difference %.3e",
+           what, dr, dl);
+}
+
+/* Compare the surface shell mesh with the full cross-section at f */
+static void shell_check (const weeks_ctx *ctx, conductor *test, int N,
+                         double f)
+{
+  conductor *full;
+  ZMAT *zs, *zv;
+  int i, shells;
+
+  shells = 0;
+  for (i=1;i<=N;i++)
+    shells += test[i].shell > 0.0;
+  if (shells == 0)
+    return;
+
+  full = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  for (i=0;i<=N;i++)
+    {
+      full[i] = test[i];
+      full[i].shell = 0.0;
+    }
+  fprintf (stderr, "\n\nChecking shell mesh against volume mesh at %.2e Hz...", f);
+  zv = solve_point (ctx, full, N, f);
+  zs = solve_point (ctx, test, N, f);
+  if (zs != ZMNULL && zv != ZMNULL)
+    print_difference ("Shell vs volume", zs, zv, N);
+  ZM_FREE (zs);
+  ZM_FREE (zv);
+  Free (full);
+}
+
+/* Compare the ideal image ground with the meshed line0 at f */
+static void ground_check (const weeks_ctx *ctx, conductor *test, int N,
+                          double f)
+{
+  conductor *meshed;
+  ZMAT *zi, *zm;
+  int i;
+
+  if (test[0].mesh != MESH_IMAGE)
+    return;
+
+  meshed = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  for (i=0;i<=N;i++)
+    meshed[i] = test[i];
+  meshed[0].mesh = MESH_FIXED;
+  fprintf (stderr, "\n\nChecking image ground against meshed ground at %.2e Hz...", f);
+  zm = solve_point (ctx, meshed, N, f);
+  zi = solve_point (ctx, test, N, f);
+  if (zi != ZMNULL && zm != ZMNULL)
+    print_difference ("Image vs meshed", zi, zm, N);
+  ZM_FREE (zi);
+  ZM_FREE (zm);
+  Free (meshed);
+}
+
+/* Print the real part (R), imaginary part over Omega (L) or magnitude
+ * (|Z|) of the n x n matrix z
+ */
+#define PART_R 0
+#define PART_L 1
+#define PART_Z 2
+
+static void print_part (FILE *out, ZMAT *z, int n, int part, double Omega)
+{
+  int i, j;
+  double v;
+
+  fprintf(out, "    ");
+  for(j=1;j<=n;j++)
+    fprintf(out, "%12d",j);
+  fprintf (out, "\n\n");
+  for(i=0;i<n;i++) {
+    fprintf (out, "%3d ",i+1);
+    for(j=0;j<n;j++) {
+      if (part == PART_R)
+        v = z->me[i][j].re;
+      else if (part == PART_L)
+        v = z->me[i][j].im/Omega;
+      else
+        v = sqrt(z->me[i][j].re * z->me[i][j].re + 
+                 z->me[i][j].im * z->me[i][j].im);
+      fprintf(out, "%+0.4e ",v);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+/* Print which conductors make up each port of g */
+static void print_group (FILE *out, const port_group *g, int N)
+{
+  int c, p, first;
+
+  fprintf (out, "\n\n*** PORT GROUP %s:", g->name);
+  for (p=1;p<=g->nport;p++)
+    {
+      fprintf (out, " %d =", p);
+      first = 1;
+      for (c=0;c<=N;c++)
+        if (g->port[c] == p)
+          {
+            fprintf (out, "%sline%d", first ? " " : "+", c);
+            first = 0;
+          }
+      fprintf (out, ",");
+    }
+  fprintf (out, " reference");
+  first = 1;
+  for (c=0;c<=N;c++)
+    if (g->port[c] == PORT_REFERENCE)
+      {
+        fprintf (out, "%sline%d", first ? " " : "+", c);
+        first = 0;
+      }
+  fprintf (out, " ***\n");
+}
+
+/* Print R, L and |Z| of the N x N port impedance z at frequency f,
+ * followed by R and L of every port grouping, to the listing of the
+ * weeks_ctx in arg. The groupings are worked out from the admittance y,
+ * or from the inverse of z where the report has none. A grouping that
+ * names lines beyond the first N (an early stage of an incremental run)
+ * is left out. Used as the report callback, so it also frees z.
+ */
+void weeks_report (ZMAT *z, ZMAT *y, double f, int N, void *arg)
+{
+  const weeks_ctx *ctx = (const weeks_ctx *) arg;
+  FILE *out = ctx->out;
+  int k;
+  double Omega = 2.0*PI*f;
+  ZMAT *yc, *zg;
+
+  fprintf (out, "\n\n========================================\n");
+  fprintf (out, "RESULTS\n");
+  fprintf (out, "========================================\n");
+  fprintf (out, "\nFREQUENCY: %e Hz (%.2f MHz)\n", f, f/1e6);
+    
+  fprintf(out, "\n*** RESISTANCE MATRIX (Ohm/m) ***\n\n");
+  print_part (out, z, N, PART_R, Omega);
+
+  fprintf(out, "\n*** INDUCTANCE MATRIX (H/m) ***\n\n");
+  print_part (out, z, N, PART_L, Omega);
+  
+  fprintf(out, "\n*** IMPEDANCE MAGNITUDE (Ohm) at %.2f MHz ***\n\n", f/1e6);
+  print_part (out, z, N, PART_Z, Omega);
+
+  /* All groupings come from the same conductor admittance */
+  if (ctx->ngroups > 0)
+    {
+      yc = y != ZMNULL ? y : zm_inverse (z, ZMNULL);
+      for (k=0;k<ctx->ngroups;k++)
+        {
+          if (!port_group_check (&ctx->groups[k], N))
+            continue;
+          zg = port_group_z (yc, &ctx->groups[k], N, ZMNULL);
+          print_group (out, &ctx->groups[k], N);
+          fprintf(out, "\n*** RESISTANCE MATRIX (Ohm/m) ***\n\n");
+          print_part (out, zg, zg->m, PART_R, Omega);
+          fprintf(out, "\n*** INDUCTANCE MATRIX (H/m) ***\n\n");
+          print_part (out, zg, zg->m, PART_L, Omega);
+          ZM_FREE (zg);
+        }
+      if (yc != y)
+        ZM_FREE (yc);
+    }
+  
+  ZM_FREE (z);
+}
+
+
+
+weeks_ctx *weeks_create (void)
+{
+  weeks_ctx *ctx;
+
+  ctx = (weeks_ctx *) Malloc (sizeof (weeks_ctx));
+  weeks_defaults (ctx);
+  return ctx;
+}
+
+void weeks_destroy (weeks_ctx *ctx)
+{
+  if (ctx == NULL)
+    return;
+  cur_close (ctx->cur);
+  prof_free (ctx->prof);
+  Free (ctx);
+}
+
+/* Read the settings of ctx and the conductors from the YAML stream fp,
+ * named name in messages. *N is the number of signal lines; the
+ * conductors are line0..line*N. Returns NULL if the input is not usable.
+ * With a profile_file or hw_counters the profile of the next run starts
+ * here, so it includes the parse.
+ */
+conductor *weeks_read (weeks_ctx *ctx, FILE *fp, const char *name, int *N)
+{
+  conductor *test;
+  prof *outer;
+  uint64_t t;
+
+  t = prof_now ();
+  test = getinput (fp, ctx, N);
+  if (ctx->profile_file[0] != '\0' || ctx->hw_counters)
+    {
+      prof_free (ctx->prof);
+      ctx->prof = prof_create (name);
+      ctx->prof->hw = ctx->hw_counters;
+    }
+  outer = prof_attach (ctx->prof);
+  prof_add (PROF_PARSE, t);
+  prof_attach (outer);
+  if (test != NULL && *N < 2)
+    {
+      fprintf (stderr, "\nERROR: %s needs line0 and at least one signal line\n",
+               name);
+      Free (test);
+      return NULL;
+    }
+  if (test != NULL)
+    (*N)--;
+  return test;
+}
+
+/* weeks_read of a YAML file */
+conductor *weeks_load (weeks_ctx *ctx, const char *file, int *N)
+{
+  conductor *test;
+  FILE *fp;
+
+  if ((fp = fopen (file, "rt")) == NULL)
+    {
+      fprintf (stderr, "ERROR: Can not open input file '%s'\n", file);
+      return NULL;
+    }
+  test = weeks_read (ctx, fp, file, N);
+  fclose (fp);
+  return test;
+}
+
+/* Choose the mesh parameters of test[] for the frequencies of ctx. *f
+ * and *fmin are the highest and lowest frequency.
+ */
+static void mesh_setup (weeks_ctx *ctx, conductor *test, int N, double *f,
+                        double *fmin)
+{
+  int i;
+
+  /* A single frequency is a sweep of one point */
+  if (ctx->nfreq == 0)
+    {
+      ctx->frequencies[0] = ctx->frequency;
+      ctx->nfreq = 1;
+    }
+
+  /* Mesh for the highest frequency of the sweep */
+  *f = ctx->frequencies[0];
+  for(i=1;i<ctx->nfreq;i++)
+    if (ctx->frequencies[i] > *f)
+      *f = ctx->frequencies[i];
+  auto_mesh (ctx, N, test, *f);
+
+  /* Surface shell only if it holds the current at the lowest frequency */
+  *fmin = ctx->frequencies[0];
+  for(i=1;i<ctx->nfreq;i++)
+    if (ctx->frequencies[i] < *fmin)
+      *fmin = ctx->frequencies[i];
+  shell_mesh (ctx, N, test, *fmin);
+  ground_mesh (ctx, N, test);
+}
+
+/* Bytes that solving cond[0..N] with the settings of ctx will hold at
+ * most: the shared Lp and the complex Z of every sweep worker, or the
+ * whole memory budget for an out-of-core solve. Meshes a copy of cond
+ * like weeks_run; -1 if it can not be meshed.
+ */
+double weeks_footprint (weeks_ctx *ctx, const conductor *cond, int N)
+{
+  conductor *test;
+  element *e, e0;
+  double f, fmin, b, per;
+  int M, n0, workers;
+
+  test = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  memcpy (test, cond, (N+1)*sizeof (conductor));
+  mesh_setup (ctx, test, N, &f, &fmin);
+  e = mesh_conductors (N, test, &e0, &M, &n0);
+  Free (test);
+  if (e == NULL)
+    return -1.0;
+  Free (e);
+
+  if (ooc_needed (ctx, M))
+    {
+      b = ctx->memory_budget;
+      if (b <= 0.0)
+        b = 0.5*(double) sysconf (_SC_PHYS_PAGES)
+            *(double) sysconf (_SC_PAGESIZE);
+      return b;
+    }
+  /* Monte Carlo workers each keep their own copy of Lp */
+  per = sweep_per_worker (M);
+  if (ctx->samples > 0)
+    per += sweep_shared (M);
+  workers = sweep_workers (sweep_shared (M), per,
+                           ctx->samples > 0 ? ctx->samples : ctx->nfreq,
+                           ctx->threads, ctx->memory_budget);
+  return sweep_shared (M)+workers*per;
+}
+
+/* Detach the profile of the run from this thread, giving it back the
+ * profile it had before, list its hardware counters and append its
+ * record to ctx->profile_file
+ */
+static int run_end (weeks_ctx *ctx, prof *outer, int ok)
+{
+  prof_attach (outer);
+  if (ctx->prof != NULL)
+    {
+      if (ctx->prof->hw)
+        prof_print_hw (stderr, ctx->prof);
+      if (ctx->profile_file[0] != '\0')
+        prof_write (ctx->prof, ctx->profile_file, ok);
+      prof_free (ctx->prof);
+      ctx->prof = NULL;
+    }
+  return ok;
+}
+
+/* Mesh test[] (line0 and N signal lines) as set up in ctx and solve it.
+ * Every port impedance goes to report in the order it is solved; a
+ * Monte Carlo run lists its statistics instead. test[] gets the mesh
+ * parameters that were chosen. Returns 0 if the settings do not fit the
+ * geometry. A context without an Lp cache gets one for the run when
+ * ctx->lp_cache names a directory. With ctx->result_cache a plain run
+ * reports the stored result of an identical earlier run instead. With
+ * ctx->profile_file the phases of the run are timed and a record of it
+ * is appended to that file, and with ctx->hw_counters the hardware
+ * counters of each phase are listed on stderr.
+ */
+int weeks_run (weeks_ctx *ctx, conductor *test, int N, sweep_report report,
+               void *arg)
+{
+  int i, ok;
+  double f, fmin;
+  lp_cache *own;
+  rc_run *rc;
+  prof *outer;
+
+  if (ctx->prof == NULL &&
+      (ctx->profile_file[0] != '\0' || ctx->hw_counters))
+    {
+      ctx->prof = prof_create ("");
+      ctx->prof->hw = ctx->hw_counters;
+    }
+  outer = prof_attach (ctx->prof);
+
+  for (i=0;i<ctx->ngroups;i++)
+    if (!port_group_check (&ctx->groups[i], N))
+      {
+        fprintf (stderr, "\nERROR: port group '%s' needs conductors of line0..line%d in every port and the reference\n",
+                 ctx->groups[i].name, N);
+        return run_end (ctx, outer, 0);
+      }
+  for (i=0;i<ctx->nsweep;i++)
+    if (ctx->sweep[i].cond > N)
+      {
+        fprintf (stderr, "\nERROR: sweep of line%d, only %d signal lines\n",
+                 ctx->sweep[i].cond, N);
+        return run_end (ctx, outer, 0);
+      }
+  for (i=0;i<ctx->ntol;i++)
+    if (ctx->tol[i].cond > N)
+      {
+        fprintf (stderr, "\nERROR: tolerance on line%d, only %d signal lines\n",
+                 ctx->tol[i].cond, N);
+        return run_end (ctx, outer, 0);
+      }
+  if (ctx->current_file[0] != '\0' &&
+      (ctx->samples > 0 || ctx->nsweep > 0 || ctx->progressive > 1 ||
+       ctx->incremental))
+    {
+      fprintf (stderr, "\nERROR: current_file is only written by plain and adaptive runs, not with %s\n",
+               ctx->samples > 0 ? "samples" : ctx->nsweep > 0 ? "sweep" :
+               ctx->progressive > 1 ? "progressive" : "incremental");
+      return run_end (ctx, outer, 0);
+    }
+  if (ctx->out_of_core != OOC_OFF && ctx->ooc_dir[0] != '\0'
+      && access (ctx->ooc_dir, W_OK | X_OK) != 0)
+    {
+      fprintf (stderr, "\nERROR: Can not write out-of-core files in %s\n",
+               ctx->ooc_dir);
+      return run_end (ctx, outer, 0);
+    }
+
+  own = NULL;
+  if (ctx->lpc == NULL && ctx->lp_cache[0] != '\0')
+    {
+      own = ctx->lpc = lpc_create (0.0);
+      if (!lpc_persist (own, ctx->lp_cache, ctx->lp_cache_size))
+        {
+          lpc_free (own);
+          ctx->lpc = NULL;
+          return run_end (ctx, outer, 0);
+        }
+    }
+
+  ok = 1;
+  mesh_setup (ctx, test, N, &f, &fmin);
+  if (ctx->shell_check)
+    shell_check (ctx, test, N, fmin);
+  if (ctx->ground_check)
+    ground_check (ctx, test, N, f);
+
+  if (ctx->samples > 0)
+    ok = monte_carlo (ctx, test, N, ctx->tol, ctx->ntol, ctx->samples,
+                 ctx->seed, ctx->samples_file, ctx->frequencies,
+                 ctx->nfreq);
+  else if (ctx->nsweep > 0)
+    ok = study (ctx, test, N, ctx->sweep, ctx->nsweep, ctx->sweep_zip,
+           ctx->frequencies, ctx->nfreq, report, arg);
+  else if (ctx->progressive > 1)
+    ok = progressive (ctx, test, N, ctx->frequencies, ctx->nfreq,
+                      ctx->progressive, ctx->progressive_tolerance,
+                      report, arg);
+  else
+    {
+      if (ctx->current_file[0] != '\0' &&
+          (ctx->cur = cur_open (ctx->current_file, ctx->current_format,
+                                N)) == NULL)
+        ok = 0;
+      else
+        {
+          rc = rc_begin (ctx, test, N, report, arg);
+          if (rc == NULL)
+            ok = solve (ctx, test, N, f, report, arg);
+          else if (!rc_replay (rc))
+            {
+              ok = solve (ctx, test, N, f, rc_keep, rc);
+              if (ok)
+                rc_store (rc);
+            }
+          rc_end (rc);
+          if (!cur_close (ctx->cur))
+            ok = 0;
+          ctx->cur = NULL;
+        }
+    }
+
+  if (own != NULL)
+    {
+      lpc_free (own);
+      ctx->lpc = NULL;
+    }
+  return run_end (ctx, outer, ok);
+}
+
+/* Append z at f to the weeks_result in arg. An incremental run reports
+ * the first lines alone before all N; such a z fills the leading block
+ * of R and L and the rest is zero.
+ */
+static void collect_result (ZMAT *z, ZMAT *y, double f, int n, void *arg)
+{
+  weeks_result *r = (weeks_result *) arg;
+  double Omega = 2.0*PI*f;
+  size_t o;
+  int i, j, N = r->N;
+
+  r->f = (double *) Realloc (r->f, (r->n+1)*sizeof (double));
+  r->z = (ZMAT **) Realloc (r->z, (r->n+1)*sizeof (ZMAT *));
+  r->R = (double *) Realloc (r->R, (size_t) (r->n+1)*N*N*sizeof (double));
+  r->L = (double *) Realloc (r->L, (size_t) (r->n+1)*N*N*sizeof (double));
+  o = (size_t) r->n*N*N;
+  for (i=0;i<N;i++)
+    for (j=0;j<N;j++)
+      {
+        r->R[o+i*N+j] = i < n && j < n ? z->me[i][j].re : 0.0;
+        r->L[o+i*N+j] = i < n && j < n ? z->me[i][j].im/Omega : 0.0;
+      }
+  r->f[r->n] = f;
+  r->z[r->n++] = z;
+}
+
+/* Solve the conductors cond[0..N] with the settings of ctx and return
+ * every port impedance, or NULL if the run could not be done. cond[]
+ * is not changed.
+ */
+weeks_result *weeks_solve (weeks_ctx *ctx, const conductor *cond, int N)
+{
+  weeks_result *r;
+  conductor *test;
+  int ok;
+
+  test = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  memcpy (test, cond, (N+1)*sizeof (conductor));
+  r = (weeks_result *) Calloc (1, sizeof (weeks_result));
+  r->N = N;
+  ok = weeks_run (ctx, test, N, collect_result, r);
+  Free (test);
+  if (!ok)
+    {
+      weeks_result_free (r);
+      return NULL;
+    }
+  return r;
+}
+
+void weeks_result_free (weeks_result *r)
+{
+  int k;
+
+  if (r == NULL)
+    return;
+  for (k=0;k<r->n;k++)
+    ZM_FREE (r->z[k]);
+  Free (r->z);
+  Free (r->f);
+  Free (r->R);
+  Free (r->L);
+  Free (r);
+}
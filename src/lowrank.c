@@ -0,0 +1,264 @@
+/* lowrank.c - Woodbury update of a factored element matrix
+ *
+ * When only the elements S of one conductor move (a spacing sweep) or
+ * change shape, Z = Z0 + D differs from the factored Z0 in the rows and
+ * columns S alone. With Ds = D(S,:) and Dc = D(:,S) with its S rows set
+ * to zero,
+ *
+ *   D = E_S Ds + Dc E_S' = U V',   U = [E_S Dc],  V' = [Ds; E_S']
+ *
+ * is of rank 2s at most, and by Sherman-Morrison-Woodbury
+ *
+ *   Z^-1 b = x0 - W (I + V' W)^-1 V' x0,   x0 = Z0^-1 b,  W = Z0^-1 U
+ *
+ * Setting up W = [P Q] takes 2s solves with the old factors (P only
+ * when S grows) and O(M s^2) for the small matrix C = I + V' W, so an
+ * update costs O(M^2 s) against O(M^3) for a new factorization. Once
+ * that is no longer cheaper (lr_worth) the matrix is assembled and
+ * factored again and becomes the new Z0.
+ *
+ * The reference element e0 must not change.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "lowrank.h"
+#include "prof.h"
+#include "mf.h"
+
+/* 1 if an update of s elements that needs 'solves' solves with the old
+ * factors costs less than the M^3/3 of a new factorization
+ */
+static int lr_worth (int M, int s, int solves)
+{
+  double m = M, n = s;
+
+  return solves*m*m + n*n*m + 8.0/3.0*n*n*n < m*m*m/3.0;
+}
+
+/* Assemble Z from L and e, factor it and make it the new Z0 */
+static void lr_refactor (lowrank *lr, const MAT *L, element *e)
+{
+  int i;
+
+  for (i=0;i<lr->M;i++)
+    memcpy (lr->L0->me[i], L->me[i], lr->M*sizeof (Real));
+  memcpy (lr->e, e, lr->M*sizeof (element));
+  calcz (lr->LU, lr->L0, lr->e, lr->n0, lr->Omega, lr->e0, lr->cond, lr->N);
+  port_factor (lr->LU, lr->pivot);
+  lr->s = 0;
+  lr->refactors++;
+}
+
+/* Factor Z = R + jwL of the mesh e at Omega, keeping what an update
+ * needs. cond must stay valid while lr is in use.
+ */
+lowrank *lr_factor (const MAT *L, element *e, element e0, int n0,
+                    conductor *cond, int N, double Omega)
+{
+  lowrank *lr;
+  int M;
+
+  M = L->m;
+  lr = (lowrank *) Calloc (1, sizeof (lowrank));
+  lr->M = M;
+  lr->n0 = n0;
+  lr->N = N;
+  lr->e0 = e0;
+  lr->cond = cond;
+  lr->Omega = Omega;
+  lr->L0 = m_get (M, M);
+  lr->e = (element *) Malloc (M*sizeof (element));
+  lr->LU = zm_get (M, M);
+  lr->pivot = px_get (M);
+  lr->S = (int *) Malloc (M*sizeof (int));
+  lr_refactor (lr, L, e);
+  lr->refactors = 0;
+  return lr;
+}
+
+/* Bring lr up to date with the partial inductances L of the elements e
+ * (same count and order as the factored mesh), of which S[0..s) changed
+ * since the last call; calclp_rows fills L for them. Elements changed
+ * in earlier calls stay in the update. Returns 1 for a low-rank update
+ * and 0 if Z was factored again.
+ */
+int lr_update (lowrank *lr, const MAT *L, element *e, const int *S, int s)
+{
+  int M, n, i, j, k, t, grown;
+  ZVEC *b, *x;
+
+  M = lr->M;
+  grown = 0;
+  for (t=0;t<s;t++)
+    {
+      for (k=0;k<lr->s && lr->S[k] != S[t];k++)
+        ;
+      if (k == lr->s)
+        {
+          lr->S[lr->s++] = S[t];
+          grown = 1;
+        }
+    }
+  if (!lr_worth (M, lr->s, grown ? 2*lr->s : lr->s))
+    {
+      lr_refactor (lr, L, e);
+      return 0;
+    }
+  n = lr->s;
+  if (n == 0)
+    return 1;
+
+  b = zv_get (M);
+  x = zv_get (M);
+
+  /* P = Z0^-1 E_S, one row per column */
+  if (grown)
+    {
+      lr->P = zm_resize (lr->P, n, M);
+      for (t=0;t<n;t++)
+        {
+          zv_zero (b);
+          b->ve[lr->S[t]].re = 1.0;
+          zzLUsolve (lr->LU, lr->pivot, b, x);
+          MEMCOPY (x->ve, lr->P->me[t], M, complex);
+        }
+    }
+
+  /* Ds = rows S of Z - Z0; the element loss changes with the shape */
+  lr->Ds = zm_resize (lr->Ds, n, M);
+  for (t=0;t<n;t++)
+    {
+      i = lr->S[t];
+      for (j=0;j<M;j++)
+        {
+          lr->Ds->me[t][j].re = 0.0;
+          lr->Ds->me[t][j].im = lr->Omega*(L->me[i][j]-lr->L0->me[i][j]);
+        }
+      if (i >= lr->n0)
+        lr->Ds->me[t][i].re =
+          calc_element_loss (&e[i], lr->Omega, lr->cond, lr->N)
+          - calc_element_loss (&lr->e[i], lr->Omega, lr->cond, lr->N);
+    }
+
+  /* Q = Z0^-1 Dc, where column t of Dc is row t of Ds without S */
+  lr->Q = zm_resize (lr->Q, n, M);
+  for (t=0;t<n;t++)
+    {
+      MEMCOPY (lr->Ds->me[t], b->ve, M, complex);
+      for (k=0;k<n;k++)
+        b->ve[lr->S[k]].re = b->ve[lr->S[k]].im = 0.0;
+      zzLUsolve (lr->LU, lr->pivot, b, x);
+      MEMCOPY (x->ve, lr->Q->me[t], M, complex);
+    }
+
+  /* C = I + V' W = I + [Ds P  Ds Q; P(S,:) Q(S,:)] */
+  lr->C = zm_resize (lr->C, 2*n, 2*n);
+  lr->cpivot = px_resize (lr->cpivot, 2*n);
+  for (t=0;t<n;t++)
+    for (k=0;k<n;k++)
+      {
+        lr->C->me[t][k] = __zip__ (lr->Ds->me[t], lr->P->me[k], M, Z_NOCONJ);
+        lr->C->me[t][n+k] = __zip__ (lr->Ds->me[t], lr->Q->me[k], M,
+                                     Z_NOCONJ);
+        lr->C->me[n+t][k] = lr->P->me[k][lr->S[t]];
+        lr->C->me[n+t][n+k] = lr->Q->me[k][lr->S[t]];
+      }
+  for (t=0;t<2*n;t++)
+    lr->C->me[t][t].re += 1.0;
+  port_factor (lr->C, lr->cpivot);
+
+  ZV_FREE (b);
+  ZV_FREE (x);
+  lr->updates++;
+  return 1;
+}
+
+/* Solve Z x = b for the current Z = Z0 + U V' */
+ZVEC *lr_solve (const lowrank *lr, ZVEC *b, ZVEC *x)
+{
+  int n, t;
+  ZVEC *v, *y;
+  complex c;
+
+  x = zzLUsolve (lr->LU, lr->pivot, b, x);
+  n = lr->s;
+  if (n == 0)
+    return x;
+
+  v = zv_get (2*n);
+  y = zv_get (2*n);
+  for (t=0;t<n;t++)
+    {
+      v->ve[t] = __zip__ (lr->Ds->me[t], x->ve, lr->M, Z_NOCONJ);
+      v->ve[n+t] = x->ve[lr->S[t]];
+    }
+  zzLUsolve (lr->C, lr->cpivot, v, y);
+  for (t=0;t<n;t++)
+    {
+      c = zneg (y->ve[t]);
+      __zmltadd__ (x->ve, lr->P->me[t], c, lr->M, Z_NOCONJ);
+      c = zneg (y->ve[n+t]);
+      __zmltadd__ (x->ve, lr->Q->me[t], c, lr->M, Z_NOCONJ);
+    }
+  ZV_FREE (v);
+  ZV_FREE (y);
+  return x;
+}
+
+/* Port admittance of the current Z, as port_reduce */
+ZMAT *lr_ports (const lowrank *lr, ZMAT *y)
+{
+  int j, k, tk;
+  ZMAT *X;
+  ZVEC *b, *x;
+  uint64_t t;
+
+  t = prof_begin ();
+  X = zm_get (lr->M, lr->N);
+  b = zv_get (lr->M);
+  x = zv_get (lr->M);
+
+  tk = lr->n0;
+  for (k=0;k<lr->N;k++)
+    {
+      zv_zero (b);
+      for (j=0;j<lr->cond[k+1].n;j++)
+        b->ve[tk+j].re = 1.0;
+      lr_solve (lr, b, x);
+      zset_col (X, k, x);
+      tk += lr->cond[k+1].n;
+    }
+  prof_count (PROF_FLOPS, PROF_SOLVE_FLOPS (lr->M, lr->N));
+  prof_add (PROF_SOLVE, t);
+  y = port_sum (X, lr->n0, lr->cond, lr->N, y);
+
+  ZV_FREE (b);
+  ZV_FREE (x);
+  ZM_FREE (X);
+  return y;
+}
+
+void lr_free (lowrank *lr)
+{
+  if (lr->C)
+    ZM_FREE (lr->C);
+  if (lr->cpivot)
+    PX_FREE (lr->cpivot);
+  if (lr->Ds)
+    ZM_FREE (lr->Ds);
+  if (lr->P)
+    ZM_FREE (lr->P);
+  if (lr->Q)
+    ZM_FREE (lr->Q);
+  Free (lr->S);
+  PX_FREE (lr->pivot);
+  ZM_FREE (lr->LU);
+  Free (lr->e);
+  M_FREE (lr->L0);
+  Free (lr);
+}
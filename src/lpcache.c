@@ -0,0 +1,625 @@
+/* lpcache.c - Lp matrices kept between solves
+ *
+ * A long running process (weeks-server) sees the same or nearly the
+ * same cross-section again and again. The cache keeps the calclp matrix
+ * of recent meshes, or the even and odd halves (sym_fill) of a mirror
+ * symmetric one, keyed by a hash of the element list and e0.
+ *
+ * A mesh seen before is not filled at all. A mesh with the same number
+ * of elements and the same e0 as a cached full matrix, but with fewer
+ * than half of its elements moved, starts from that matrix and redoes
+ * the rows and columns of the moved elements only (calclp_rows), like a
+ * geometry sweep does in study.c.
+ *
+ * Callers get their own copy of a matrix held in memory, so a solve
+ * never shares an entry that may be evicted. Entries beyond the size of
+ * the cache are dropped least recently used first. All calls may be
+ * made from concurrent solves; the fills themselves run outside the
+ * lock.
+ *
+ * With a cache directory (lpc_persist) every new matrix is also written
+ * to a file named by the mesh hash, and a later run on the same mesh,
+ * whatever its materials and frequencies, maps that file read-only and
+ * solves straight from the mapping instead of filling. Such a matrix is
+ * a view of the mapping that callers must not write to (a write faults)
+ * and must give back with lpc_release. The sizes in a file header are
+ * checked against the mesh before it is mapped as matrices. Files are
+ * written under a temporary name and renamed, so several processes may
+ * share a directory. A hit touches the file; once the files exceed the
+ * size of the directory the oldest are removed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "symmetry.h"
+#include "lpcache.h"
+#include "mf.h"
+
+#define LPC_FULL 0        /* L is the calclp matrix */
+#define LPC_SYM  1        /* L and Lo are the even and odd halves */
+
+#define LPC_MAGIC "WEEKSLP1"
+
+/* Header of a cache file, followed by the M elements and the rows of L
+ * and Lo. Everything is a multiple of 8 bytes, so the matrices are
+ * aligned in the mapping.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t kind, M;
+  uint32_t m, n, mo, no;  /* size of L and Lo, mo = no = 0 without Lo */
+  uint64_t key;
+  element e0;
+} lpc_file;
+
+/* A mapped cache file and the matrices viewing it */
+typedef struct lpc_map {
+  void *addr;
+  size_t len;
+  int refs;
+} lpc_map;
+
+typedef struct lpc_view {
+  MAT *A;
+  lpc_map *map;
+  struct lpc_view *next;
+} lpc_view;
+
+typedef struct lpc_entry {
+  uint64_t key;
+  int kind, M;
+  element *e, e0;         /* the mesh the matrices belong to */
+  MAT *L, *Lo;
+  double bytes;
+  unsigned long used;     /* cache clock at the last use */
+  struct lpc_entry *next;
+} lpc_entry;
+
+struct lp_cache {
+  pthread_mutex_t lock;
+  lpc_entry *head;
+  double bytes, max;
+  unsigned long clock;
+  int hits, partial, misses;
+  char *dir;              /* cache directory or NULL */
+  double disk_max;
+  unsigned long tmp;      /* temporary file counter */
+  lpc_view *views;        /* matrices handed out from mappings */
+};
+
+static uint64_t hash_element (uint64_t h, const element *a)
+{
+  double v[4];
+  const unsigned char *p;
+  size_t i;
+
+  /* -0.0 and 0.0 are the same coordinate */
+  v[0] = a->x1+0.0;
+  v[1] = a->x2+0.0;
+  v[2] = a->y1+0.0;
+  v[3] = a->y2+0.0;
+  p = (const unsigned char *) v;
+  for (i=0;i<sizeof (v);i++)
+    h = (h^p[i])*1099511628211ULL;
+  return h;
+}
+
+/* FNV-1a over the element list, e0 and the kind of entry */
+static uint64_t mesh_key (const element *e, int M, element e0, int kind)
+{
+  uint64_t h = 14695981039346656037ULL;
+  int i;
+
+  for (i=0;i<M;i++)
+    h = hash_element (h, &e[i]);
+  h = hash_element (h, &e0);
+  return h^(uint64_t) kind;
+}
+
+static int same_element (const element *a, const element *b)
+{
+  return a->x1 == b->x1 && a->x2 == b->x2 && a->y1 == b->y1 &&
+         a->y2 == b->y2;
+}
+
+static int same_mesh (const element *a, const element *b, int M)
+{
+  int i;
+
+  for (i=0;i<M;i++)
+    if (!same_element (&a[i], &b[i]))
+      return 0;
+  return 1;
+}
+
+lp_cache *lpc_create (double bytes)
+{
+  lp_cache *c;
+
+  c = (lp_cache *) Calloc (1, sizeof (lp_cache));
+  pthread_mutex_init (&c->lock, NULL);
+  c->max = bytes;
+  return c;
+}
+
+static void entry_free (lpc_entry *n)
+{
+  M_FREE (n->L);
+  if (n->Lo)
+    M_FREE (n->Lo);
+  Free (n->e);
+  Free (n);
+}
+
+/* Entry of kind for the mesh, or NULL. Needs the lock. */
+static lpc_entry *find (lp_cache *c, uint64_t key, int kind,
+                        const element *e, int M, element e0)
+{
+  lpc_entry *n;
+
+  for (n=c->head;n;n=n->next)
+    if (n->key == key && n->kind == kind && n->M == M &&
+        same_element (&n->e0, &e0) && same_mesh (n->e, e, M))
+      return n;
+  return NULL;
+}
+
+/* Keep copies of L (and Lo) for the mesh e, then drop the least
+ * recently used entries over the size of the cache
+ */
+static void insert (lp_cache *c, uint64_t key, int kind, const element *e,
+                    int M, element e0, MAT *L, MAT *Lo)
+{
+  lpc_entry *n, **pp, **lru;
+
+  if (c->max <= 0.0)
+    return;
+  n = (lpc_entry *) Calloc (1, sizeof (lpc_entry));
+  n->key = key;
+  n->kind = kind;
+  n->M = M;
+  n->e = (element *) Malloc (M*sizeof (element));
+  memcpy (n->e, e, M*sizeof (element));
+  n->e0 = e0;
+  n->L = m_copy (L, MNULL);
+  n->Lo = Lo ? m_copy (Lo, MNULL) : MNULL;
+  n->bytes = (double) L->m*L->n*sizeof (Real) + M*sizeof (element)
+             + (Lo ? (double) Lo->m*Lo->n*sizeof (Real) : 0.0);
+
+  pthread_mutex_lock (&c->lock);
+  if (find (c, key, kind, e, M, e0) != NULL)
+    {
+      /* filled by a concurrent solve in the meantime */
+      pthread_mutex_unlock (&c->lock);
+      entry_free (n);
+      return;
+    }
+  n->used = ++c->clock;
+  n->next = c->head;
+  c->head = n;
+  c->bytes += n->bytes;
+  while (c->bytes > c->max && c->head->next != NULL)
+    {
+      lru = NULL;
+      for (pp=&c->head;*pp;pp=&(*pp)->next)
+        if (lru == NULL || (*pp)->used < (*lru)->used)
+          lru = pp;
+      n = *lru;
+      *lru = n->next;
+      c->bytes -= n->bytes;
+      entry_free (n);
+    }
+  pthread_mutex_unlock (&c->lock);
+}
+
+/* Use the directory dir, of at most bytes (<= 0: unlimited), for the
+ * matrices of this and later runs. Returns 0 if it can not be used.
+ */
+int lpc_persist (lp_cache *c, const char *dir, double bytes)
+{
+  struct stat st;
+
+  if (mkdir (dir, 0777) != 0 &&
+      (stat (dir, &st) != 0 || !S_ISDIR (st.st_mode)))
+    {
+      fprintf (stderr, "\nERROR: Can not use Lp cache directory %s", dir);
+      return 0;
+    }
+  c->dir = (char *) Malloc (strlen (dir)+1);
+  strcpy (c->dir, dir);
+  c->disk_max = bytes;
+  return 1;
+}
+
+static void file_name (const lp_cache *c, uint64_t key, int kind, char *buf,
+                       size_t n)
+{
+  snprintf (buf, n, "%s/%016llx%s.lp", c->dir, (unsigned long long) key,
+            kind == LPC_SYM ? "s" : "");
+}
+
+/* Read-only MAT on m x n doubles of a mapping */
+static MAT *view (lp_cache *c, lpc_map *map, Real *base, int m, int n)
+{
+  lpc_view *v;
+  MAT *A;
+  int i;
+
+  A = (MAT *) Calloc (1, sizeof (MAT));
+  A->m = A->max_m = m;
+  A->n = A->max_n = n;
+  A->base = base;
+  A->me = (Real **) Malloc (m*sizeof (Real *));
+  for (i=0;i<m;i++)
+    A->me[i] = base+(size_t) i*n;
+
+  v = (lpc_view *) Malloc (sizeof (lpc_view));
+  v->A = A;
+  v->map = map;
+  pthread_mutex_lock (&c->lock);
+  map->refs++;
+  v->next = c->views;
+  c->views = v;
+  pthread_mutex_unlock (&c->lock);
+  return A;
+}
+
+/* Map the file of the mesh and return views on its L (m x m) and Lo
+ * (mo x mo), or 0 if there is no (valid) file
+ */
+static int disk_find (lp_cache *c, uint64_t key, int kind, const element *e,
+                      int M, element e0, int m, int mo, MAT **L, MAT **Lo)
+{
+  char name[1024];
+  struct stat st;
+  lpc_file *h;
+  lpc_map *map;
+  char *p;
+  size_t len;
+  int fd;
+
+  file_name (c, key, kind, name, sizeof (name));
+  if ((fd = open (name, O_RDONLY)) < 0)
+    return 0;
+  if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (lpc_file))
+    {
+      close (fd);
+      return 0;
+    }
+  len = st.st_size;
+  p = (char *) mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+      close (fd);
+      return 0;
+    }
+  h = (lpc_file *) p;
+  if (memcmp (h->magic, LPC_MAGIC, 8) != 0 || h->kind != (uint32_t) kind ||
+      h->M != (uint32_t) M || !same_element (&h->e0, &e0) ||
+      h->m != (uint32_t) m || h->n != (uint32_t) m ||
+      h->mo != (uint32_t) mo || h->no != (uint32_t) mo ||
+      len != sizeof (lpc_file) + M*sizeof (element)
+             + ((size_t) h->m*h->n + (size_t) h->mo*h->no)*sizeof (Real) ||
+      !same_mesh ((element *) (p+sizeof (lpc_file)), e, M))
+    {
+      /* another mesh with the same hash, or a stale format */
+      munmap (p, len);
+      close (fd);
+      return 0;
+    }
+  futimens (fd, NULL);
+  close (fd);
+
+  map = (lpc_map *) Calloc (1, sizeof (lpc_map));
+  map->addr = p;
+  map->len = len;
+  p += sizeof (lpc_file) + M*sizeof (element);
+  *L = view (c, map, (Real *) p, h->m, h->n);
+  if (Lo)
+    *Lo = view (c, map, (Real *) p+(size_t) h->m*h->n, h->mo, h->no);
+  return 1;
+}
+
+typedef struct {
+  char name[256];
+  double bytes;
+  struct timespec used;
+} lpc_disk;
+
+static int older (const void *a, const void *b)
+{
+  const struct timespec *s = &((const lpc_disk *) a)->used;
+  const struct timespec *t = &((const lpc_disk *) b)->used;
+
+  if (s->tv_sec != t->tv_sec)
+    return s->tv_sec < t->tv_sec ? -1 : 1;
+  return s->tv_nsec < t->tv_nsec ? -1 : s->tv_nsec > t->tv_nsec;
+}
+
+/* Remove the least recently used files over the size of the directory,
+ * always keeping the newest one
+ */
+static void disk_evict (lp_cache *c)
+{
+  char name[1024];
+  struct dirent *d;
+  struct stat st;
+  lpc_disk *f;
+  double total;
+  size_t len;
+  int n, i;
+  DIR *dp;
+
+  if (c->disk_max <= 0.0 || (dp = opendir (c->dir)) == NULL)
+    return;
+  f = NULL;
+  n = 0;
+  total = 0.0;
+  while ((d = readdir (dp)) != NULL)
+    {
+      len = strlen (d->d_name);
+      if (len < 4 || len >= sizeof (f->name) ||
+          strcmp (d->d_name+len-3, ".lp") != 0)
+        continue;
+      snprintf (name, sizeof (name), "%s/%s", c->dir, d->d_name);
+      if (stat (name, &st) != 0)
+        continue;
+      f = (lpc_disk *) Realloc (f, (n+1)*sizeof (lpc_disk));
+      strcpy (f[n].name, d->d_name);
+      f[n].bytes = (double) st.st_size;
+      f[n].used = st.st_mtim;
+      total += f[n++].bytes;
+    }
+  closedir (dp);
+
+  if (total > c->disk_max)
+    {
+      qsort (f, n, sizeof (lpc_disk), older);
+      for (i=0;i<n-1 && total>c->disk_max;i++)
+        {
+          snprintf (name, sizeof (name), "%s/%s", c->dir, f[i].name);
+          unlink (name);
+          total -= f[i].bytes;
+        }
+    }
+  if (f)
+    Free (f);
+}
+
+/* Write L (and Lo) of the mesh to its file */
+static void disk_store (lp_cache *c, uint64_t key, int kind, const element *e,
+                        int M, element e0, MAT *L, MAT *Lo)
+{
+  char name[1024], tmp[1024];
+  unsigned long id;
+  lpc_file h;
+  FILE *fp;
+  int i, ok;
+
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, LPC_MAGIC, 8);
+  h.kind = kind;
+  h.M = M;
+  h.m = L->m;
+  h.n = L->n;
+  h.mo = Lo ? Lo->m : 0;
+  h.no = Lo ? Lo->n : 0;
+  h.key = key;
+  h.e0 = e0;
+
+  pthread_mutex_lock (&c->lock);
+  id = ++c->tmp;
+  pthread_mutex_unlock (&c->lock);
+  file_name (c, key, kind, name, sizeof (name));
+  snprintf (tmp, sizeof (tmp), "%s/.%016llx.%d.%lu.tmp", c->dir,
+            (unsigned long long) key, (int) getpid (), id);
+  if ((fp = fopen (tmp, "wb")) == NULL)
+    return;
+  ok = fwrite (&h, sizeof (h), 1, fp) == 1 &&
+       fwrite (e, sizeof (element), M, fp) == (size_t) M;
+  for (i=0;ok && i<(int) L->m;i++)
+    ok = fwrite (L->me[i], sizeof (Real), L->n, fp) == L->n;
+  for (i=0;ok && Lo && i<(int) Lo->m;i++)
+    ok = fwrite (Lo->me[i], sizeof (Real), Lo->n, fp) == Lo->n;
+  if (fclose (fp) != 0 || !ok || rename (tmp, name) != 0)
+    {
+      fprintf (stderr, "\n  Lp cache: can not write %s", name);
+      unlink (tmp);
+      return;
+    }
+  disk_evict (c);
+}
+
+/* The calclp matrix of the M elements e. Give it back with lpc_release. */
+MAT *lpc_full (lp_cache *c, element *e, element e0, int M)
+{
+  lpc_entry *n, *near;
+  uint64_t key;
+  int *S, i, s, best;
+  MAT *L;
+
+  key = mesh_key (e, M, e0, LPC_FULL);
+  S = NULL;
+  s = 0;
+
+  pthread_mutex_lock (&c->lock);
+  n = find (c, key, LPC_FULL, e, M, e0);
+  if (n != NULL)
+    {
+      L = m_copy (n->L, MNULL);
+      n->used = ++c->clock;
+      c->hits++;
+      pthread_mutex_unlock (&c->lock);
+      return L;
+    }
+  pthread_mutex_unlock (&c->lock);
+
+  if (c->dir && disk_find (c, key, LPC_FULL, e, M, e0, M, 0, &L, NULL))
+    {
+      fprintf (stderr, "\n  Lp cache: mapped from %s", c->dir);
+      pthread_mutex_lock (&c->lock);
+      c->hits++;
+      pthread_mutex_unlock (&c->lock);
+      return L;
+    }
+
+  /* The cached mesh with the fewest moved elements */
+  L = m_get (M, M);
+  pthread_mutex_lock (&c->lock);
+  near = NULL;
+  best = M/2;
+  for (n=c->head;n;n=n->next)
+    {
+      if (n->kind != LPC_FULL || n->M != M || !same_element (&n->e0, &e0))
+        continue;
+      for (i=s=0;i<M && s<best;i++)
+        s += !same_element (&n->e[i], &e[i]);
+      if (s < best)
+        {
+          near = n;
+          best = s;
+        }
+    }
+  if (near != NULL)
+    {
+      m_copy (near->L, L);
+      near->used = ++c->clock;
+      S = (int *) Malloc ((best+1)*sizeof (int));
+      for (i=s=0;i<M;i++)
+        if (!same_element (&near->e[i], &e[i]))
+          S[s++] = i;
+      c->partial++;
+    }
+  else
+    c->misses++;
+  pthread_mutex_unlock (&c->lock);
+
+  if (near != NULL)
+    {
+      fprintf (stderr, "\n  Lp cache: %d of %d elements moved", s, M);
+      calclp_rows (L, e, e0, S, s);
+      Free (S);
+    }
+  else
+    calclp (L, e, e0);
+  insert (c, key, LPC_FULL, e, M, e0, L, MNULL);
+  if (c->dir)
+    disk_store (c, key, LPC_FULL, e, M, e0, L, MNULL);
+  return L;
+}
+
+/* Fill the even and odd halves of sym, like sym_fill. Give them back
+ * with lpc_release.
+ */
+void lpc_sym (lp_cache *c, symmetry *sym)
+{
+  lpc_entry *n;
+  uint64_t key;
+  int M;
+
+  M = 2*sym->np+sym->ns;
+  key = mesh_key (sym->e, M, sym->e0, LPC_SYM);
+  pthread_mutex_lock (&c->lock);
+  n = find (c, key, LPC_SYM, sym->e, M, sym->e0);
+  if (n != NULL)
+    {
+      sym->Le = m_copy (n->L, MNULL);
+      sym->Lo = m_copy (n->Lo, MNULL);
+      n->used = ++c->clock;
+      c->hits++;
+      pthread_mutex_unlock (&c->lock);
+      return;
+    }
+  pthread_mutex_unlock (&c->lock);
+
+  if (c->dir &&
+      disk_find (c, key, LPC_SYM, sym->e, M, sym->e0, sym->np+sym->ns,
+                 sym->np > 0 ? sym->np : 1, &sym->Le, &sym->Lo))
+    {
+      fprintf (stderr, "\n  Lp cache: mapped from %s", c->dir);
+      pthread_mutex_lock (&c->lock);
+      c->hits++;
+      pthread_mutex_unlock (&c->lock);
+      return;
+    }
+  pthread_mutex_lock (&c->lock);
+  c->misses++;
+  pthread_mutex_unlock (&c->lock);
+
+  sym_fill (sym);
+  insert (c, key, LPC_SYM, sym->e, M, sym->e0, sym->Le, sym->Lo);
+  if (c->dir)
+    disk_store (c, key, LPC_SYM, sym->e, M, sym->e0, sym->Le, sym->Lo);
+}
+
+/* Free a matrix from lpc_full or lpc_sym; c may be NULL for one that
+ * did not come from a cache
+ */
+void lpc_release (lp_cache *c, MAT *A)
+{
+  lpc_view *v, **pp;
+
+  if (A == MNULL)
+    return;
+  if (c != NULL)
+    {
+      pthread_mutex_lock (&c->lock);
+      for (pp=&c->views;*pp && (*pp)->A != A;pp=&(*pp)->next)
+        ;
+      if ((v = *pp) != NULL)
+        {
+          *pp = v->next;
+          if (--v->map->refs == 0)
+            {
+              munmap (v->map->addr, v->map->len);
+              Free (v->map);
+            }
+          pthread_mutex_unlock (&c->lock);
+          Free (A->me);
+          Free (A);
+          Free (v);
+          return;
+        }
+      pthread_mutex_unlock (&c->lock);
+    }
+  M_FREE (A);
+}
+
+void lpc_stats (lp_cache *c, int *hits, int *partial, int *misses,
+                double *bytes)
+{
+  pthread_mutex_lock (&c->lock);
+  *hits = c->hits;
+  *partial = c->partial;
+  *misses = c->misses;
+  *bytes = c->bytes;
+  pthread_mutex_unlock (&c->lock);
+}
+
+void lpc_free (lp_cache *c)
+{
+  lpc_entry *n;
+
+  if (c == NULL)
+    return;
+  while ((n = c->head) != NULL)
+    {
+      c->head = n->next;
+      entry_free (n);
+    }
+  if (c->dir)
+    Free (c->dir);
+  pthread_mutex_destroy (&c->lock);
+  Free (c);
+}
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include "weeks.h"
 #include "lpp.h"
+#include "prof.h"
 
 static char rcsid[]="$Id: lpp.c,v 1.1 1995/12/28 15:45:36 os Exp os $";
 
@@ -44,6 +45,7 @@ double lp (element *e1, element *e2)
   double x11, x112, x12, x122, x21, x212, x22, x222;
   double y11, y112, y12, y122, y21, y212, y22, y222;
   
+  prof_lp_calls++;
   x11 = e1->x1 - e2->x1;
   x112 = x11 * x11;
   x12 = e1->x1 - e2->x2;
@@ -1,83 +1,440 @@
+/* mf.c - counted allocation
+ *
+ * Every block from Malloc, Calloc and Realloc starts with a header that
+ * holds its size, so Free and Realloc find it in constant time and the
+ * count of bytes in use and its peak are kept with atomic operations,
+ * without a lock on any allocation path.
+ *
+ * Meschach objects are made by the library, so they carry no header.
+ * The wrappers at the end count those made through mf.h: each is
+ * entered in a small hash table with its size, and taken out again
+ * when it is freed. An object the library made on its own is freed
+ * without being counted either way.
+ *
+ * An arena hands out scratch memory of one phase from large chunks and
+ * gives it all back at once.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#define MF_C
+#include "zmatrix2.h"
 #include "mf.h"
 
-struct {
-  void *m;
+#define MF_MAGIC 0x6d66626cUL
+
+/* Block header, 16 bytes to keep the alignment of malloc */
+typedef struct {
   size_t n;
-} a[3000];
+  size_t magic;
+} mf_head;
 
-size_t tot=0,mmax=0;
-unsigned w=0;
+static size_t tot=0,mmax=0;
 
-void Free(void *m)
+static void count(size_t add, size_t sub)
 {
-  int i;
-  i = 0;
-  while(1) {
-    if(i>2999) {
-      printf("#");
-      break;
-    }
-    if(a[i].m==m) {
-      tot -= a[i].n;
-      a[i].n = 0;
-      a[i].m = NULL; 
-      break;
-    }
-    i++;
+  size_t now, peak;
+
+  if (add >= sub)
+    now = __atomic_add_fetch(&tot, add-sub, __ATOMIC_RELAXED);
+  else
+    now = __atomic_sub_fetch(&tot, sub-add, __ATOMIC_RELAXED);
+  peak = __atomic_load_n(&mmax, __ATOMIC_RELAXED);
+  while (now > peak &&
+         !__atomic_compare_exchange_n(&mmax, &peak, now, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+    ;
+}
+
+static mf_head *head(void *m)
+{
+  mf_head *h = (mf_head *) m - 1;
+
+  if (h->magic != MF_MAGIC) {
+    fprintf(stderr, "\nERROR: Free of a block not from Malloc\n");
+    abort();
   }
-  free(m);
+  return h;
 }
 
-void *Calloc(size_t n, size_t m)
+void Free(void *m)
 {
-  void *b;
-  b=calloc(n,m);
-  a[w].n=n*m;
-  tot += n*m;
-  a[w].m=b;
-  w++;
-  if(tot>mmax) mmax=tot;
-  return(b);
+  mf_head *h;
+
+  if(m==NULL)
+    return;
+  h = head(m);
+  count(0, h->n);
+  h->magic = 0;
+  free(h);
 }
 
 void *Malloc(size_t n)
 {
-  void *b;
-  b=malloc(n);
-  a[w].n=n;
-  tot += n;
-  a[w].m=b;
-  w++;
-  if(tot>mmax) mmax=tot;
-  return(b);
+  mf_head *h;
+
+  h = (mf_head *) malloc(sizeof(mf_head)+n);
+  if (h == NULL)
+    return NULL;
+  h->n = n;
+  h->magic = MF_MAGIC;
+  count(n, 0);
+  return h+1;
+}
+
+void *Calloc(size_t n, size_t m)
+{
+  mf_head *h;
+
+  if (m != 0 && n > ((size_t) -1 - sizeof(mf_head))/m)
+    return NULL;
+  h = (mf_head *) calloc(1, sizeof(mf_head)+n*m);
+  if (h == NULL)
+    return NULL;
+  h->n = n*m;
+  h->magic = MF_MAGIC;
+  count(n*m, 0);
+  return h+1;
 }
 
 void *Realloc(void *m, size_t n)
 {
-  int i;
-  void *b;
-  i = 0;
-  while(1) {
-    if(i>2999) {
-      printf("#");
-      break;
+  mf_head *h;
+  size_t old;
+
+  if (m == NULL)
+    return Malloc(n);
+  h = head(m);
+  old = h->n;
+  h = (mf_head *) realloc(h, sizeof(mf_head)+n);
+  if (h == NULL)
+    return NULL;
+  h->n = n;
+  count(n, old);
+  return h+1;
+}
+
+size_t get_max_memory (void)
+{
+  return __atomic_load_n(&mmax, __ATOMIC_RELAXED);
+}
+
+/* Bytes in use now */
+size_t get_memory (void)
+{
+  return __atomic_load_n(&tot, __ATOMIC_RELAXED);
+}
+
+
+/* Arenas: a list of chunks, the newest first, each filled from the
+ * front. A request larger than the chunk size gets a chunk of its own.
+ */
+typedef struct mf_chunk {
+  struct mf_chunk *next;
+  size_t size, used;
+  size_t pad;                   /* keeps the data 16 byte aligned */
+} mf_chunk;
+
+struct mf_arena {
+  mf_chunk *chunk;
+  size_t size;
+};
+
+mf_arena *mf_arena_create (size_t size)
+{
+  mf_arena *a;
+
+  a = (mf_arena *) Calloc (1, sizeof (mf_arena));
+  a->size = size > 0 ? size : 65536;
+  return a;
+}
+
+void *mf_arena_alloc (mf_arena *a, size_t n)
+{
+  mf_chunk *c;
+  size_t size;
+  char *p;
+
+  n = (n+15) & ~(size_t) 15;
+  c = a->chunk;
+  if (c == NULL || c->size-c->used < n)
+    {
+      size = n > a->size ? n : a->size;
+      c = (mf_chunk *) Malloc (sizeof (mf_chunk)+size);
+      c->size = size;
+      c->used = 0;
+      if (n > a->size && a->chunk != NULL)
+        {
+          /* keep filling the current chunk */
+          c->next = a->chunk->next;
+          a->chunk->next = c;
+        }
+      else
+        {
+          c->next = a->chunk;
+          a->chunk = c;
+        }
     }
-    if(a[i].m==m) {
-      tot -= a[i].n;
-      break;
+  p = (char *) (c+1)+c->used;
+  c->used += n;
+  return p;
+}
+
+/* Give back everything allocated from a, keeping one chunk */
+void mf_arena_reset (mf_arena *a)
+{
+  mf_chunk *c, *next;
+
+  if (a->chunk == NULL)
+    return;
+  for (c=a->chunk->next;c;c=next)
+    {
+      next = c->next;
+      Free (c);
     }
-    i++;
+  a->chunk->next = NULL;
+  a->chunk->used = 0;
+}
+
+void mf_arena_free (mf_arena *a)
+{
+  if (a == NULL)
+    return;
+  mf_arena_reset (a);
+  if (a->chunk)
+    Free (a->chunk);
+  Free (a);
+}
+
+
+/* Meschach objects: open addressing on the address, with deleted slots
+ * marked and the table rebuilt when it gets half full
+ */
+#define DELETED ((const void *) 1)
+
+typedef struct {
+  const void *p;
+  size_t n;
+} mf_obj;
+
+static mf_obj *obj;
+static size_t nslot, nfull;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t slot(const void *p)
+{
+  return (size_t) (((uintptr_t) p >> 4) * 0x9e3779b97f4a7c15ULL) & (nslot-1);
+}
+
+static void obj_insert(const void *p, size_t n)
+{
+  size_t i;
+
+  for (i=slot(p); obj[i].p != NULL && obj[i].p != DELETED; i=(i+1)&(nslot-1))
+    ;
+  if (obj[i].p == NULL)
+    nfull++;
+  obj[i].p = p;
+  obj[i].n = n;
+}
+
+/* Enter object p of n bytes */
+static void obj_add(const void *p, size_t n)
+{
+  mf_obj *old;
+  size_t i, nold;
+
+  if (p == NULL)
+    return;
+  pthread_mutex_lock(&lock);
+  if (2*(nfull+1) > nslot) {
+    old = obj;
+    nold = nslot;
+    nslot = nslot ? 2*nslot : 1024;
+    obj = (mf_obj *) calloc(nslot, sizeof(mf_obj));
+    nfull = 0;
+    for (i=0;i<nold;i++)
+      if (old[i].p != NULL && old[i].p != DELETED)
+        obj_insert(old[i].p, old[i].n);
+    free(old);
   }
-  b = realloc(m,n);
-  a[i].m=b;
-  a[i].n=n;
-  tot += n;
-  return b;
+  obj_insert(p, n);
+  pthread_mutex_unlock(&lock);
+  count(n, 0);
 }
 
-size_t get_max_memory (void)
+/* Take out object p and return its size, 0 if it was not entered */
+static size_t obj_take(const void *p)
+{
+  size_t i, n;
+
+  if (p == NULL)
+    return 0;
+  n = 0;
+  pthread_mutex_lock(&lock);
+  if (nslot > 0)
+    for (i=slot(p); obj[i].p != NULL; i=(i+1)&(nslot-1))
+      if (obj[i].p == p) {
+        n = obj[i].n;
+        obj[i].p = DELETED;
+        break;
+      }
+  pthread_mutex_unlock(&lock);
+  count(0, n);
+  return n;
+}
+
+static size_t mat_bytes(const MAT *A)
+{
+  return sizeof(MAT) + A->max_m*sizeof(Real *) + A->max_size*sizeof(Real);
+}
+
+static size_t zmat_bytes(const ZMAT *A)
+{
+  return sizeof(ZMAT) + A->max_m*sizeof(complex *)
+         + A->max_size*sizeof(complex);
+}
+
+MAT *mf_m_get(int m, int n)
+{
+  MAT *A = m_get(m, n);
+
+  obj_add(A, mat_bytes(A));
+  return A;
+}
+
+/* A resized object stays counted if it was (or is new) */
+MAT *mf_m_resize(MAT *A, int m, int n)
+{
+  int counted = A == MNULL || obj_take(A) > 0;
+
+  A = m_resize(A, m, n);
+  if (counted)
+    obj_add(A, mat_bytes(A));
+  return A;
+}
+
+MAT *mf_m_copy(MAT *A, MAT *B, u_int i0, u_int j0)
+{
+  if (B != A && (B == MNULL || B->m < A->m || B->n < A->n))
+    B = mf_m_resize(B, A->m, A->n);
+  return _m_copy(A, B, i0, j0);
+}
+
+int mf_m_free(MAT *A)
+{
+  obj_take(A);
+  return m_free(A);
+}
+
+VEC *mf_v_get(int n)
+{
+  VEC *x = v_get(n);
+
+  obj_add(x, sizeof(VEC) + x->max_dim*sizeof(Real));
+  return x;
+}
+
+VEC *mf_v_resize(VEC *x, int n)
+{
+  int counted = x == VNULL || obj_take(x) > 0;
+
+  x = v_resize(x, n);
+  if (counted)
+    obj_add(x, sizeof(VEC) + x->max_dim*sizeof(Real));
+  return x;
+}
+
+int mf_v_free(VEC *x)
+{
+  obj_take(x);
+  return v_free(x);
+}
+
+PERM *mf_px_get(int n)
+{
+  PERM *p = px_get(n);
+
+  obj_add(p, sizeof(PERM) + p->max_size*sizeof(u_int));
+  return p;
+}
+
+PERM *mf_px_resize(PERM *p, int n)
+{
+  int counted = p == PNULL || obj_take(p) > 0;
+
+  p = px_resize(p, n);
+  if (counted)
+    obj_add(p, sizeof(PERM) + p->max_size*sizeof(u_int));
+  return p;
+}
+
+int mf_px_free(PERM *p)
+{
+  obj_take(p);
+  return px_free(p);
+}
+
+ZMAT *mf_zm_get(int m, int n)
+{
+  ZMAT *A = zm_get(m, n);
+
+  obj_add(A, zmat_bytes(A));
+  return A;
+}
+
+ZMAT *mf_zm_resize(ZMAT *A, int m, int n)
+{
+  int counted = A == ZMNULL || obj_take(A) > 0;
+
+  A = zm_resize(A, m, n);
+  if (counted)
+    obj_add(A, zmat_bytes(A));
+  return A;
+}
+
+ZMAT *mf_zm_copy(ZMAT *A, ZMAT *B, u_int i0, u_int j0)
+{
+  if (B != A && (B == ZMNULL || B->m < A->m || B->n < A->n))
+    B = mf_zm_resize(B, A->m, A->n);
+  return _zm_copy(A, B, i0, j0);
+}
+
+ZMAT *mf_zm_inverse(ZMAT *A, ZMAT *B)
+{
+  if (B == ZMNULL || B->m < A->m || B->n < A->n)
+    B = mf_zm_resize(B, A->m, A->n);
+  return zm_inverse(A, B);
+}
+
+int mf_zm_free(ZMAT *A)
+{
+  obj_take(A);
+  return zm_free(A);
+}
+
+ZVEC *mf_zv_get(int n)
+{
+  ZVEC *x = zv_get(n);
+
+  obj_add(x, sizeof(ZVEC) + x->max_dim*sizeof(complex));
+  return x;
+}
+
+ZVEC *mf_zv_resize(ZVEC *x, int n)
+{
+  int counted = x == ZVNULL || obj_take(x) > 0;
+
+  x = zv_resize(x, n);
+  if (counted)
+    obj_add(x, sizeof(ZVEC) + x->max_dim*sizeof(complex));
+  return x;
+}
+
+int mf_zv_free(ZVEC *x)
 {
-  return mmax;
+  obj_take(x);
+  return zv_free(x);
 }
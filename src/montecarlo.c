@@ -0,0 +1,446 @@
+/* montecarlo.c - manufacturing tolerance analysis
+ *
+ * Every sample perturbs the conductor fields named in the tolerances
+ * (each signal line on its own for 'conductor: all'), meshes the
+ * perturbed cross-section and solves it at every frequency. The Lp
+ * matrix of the nominal mesh is filled once and shared read-only by a
+ * pool of worker threads. Each worker keeps its own copy, in which only
+ * the rows and columns of the elements that differ from the nominal
+ * mesh are redone (calclp_rows) and those of the previous sample are
+ * restored, so the blocks between unperturbed conductors are never
+ * recomputed. The worker's Z, pivot and copy are reused for all its
+ * samples. A sample whose mesh has another element count or e0 is
+ * filled from scratch.
+ *
+ * Sample k draws its numbers from its own generator seeded by the seed
+ * and k, so the results do not depend on the number of threads.
+ * The output is the mean, standard deviation and percentiles of every
+ * R and L entry, and optionally every sample as CSV.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "montecarlo.h"
+#include "prof.h"
+#include "trace.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+typedef struct {
+  conductor *nominal;
+  int N;
+  element *e;                   /* nominal mesh */
+  element e0;
+  int M, n0;
+  const MAT *L0;
+  const tolerance *tol;
+  int ntol, nval;
+  const double *freq;
+  int nfreq;
+  unsigned long seed;
+  int samples;
+  double *val;                  /* samples x nval perturbed values */
+  double *R, *L;                /* samples x nfreq x N x N */
+  int next, done, refills;
+  int failed;                   /* a sample could not be meshed */
+  prof *prof;                   /* of the calling thread */
+  pthread_mutex_t lock;
+} mc_state;
+
+/* splitmix64: the next of the generator s, uniform in (0, 1) */
+double uniform01 (uint64_t *s)
+{
+  uint64_t z;
+
+  z = (*s += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return ((z >> 11) + 0.5) * (1.0/9007199254740992.0);
+}
+
+static double draw (uint64_t *s, const tolerance *t)
+{
+  double u, v;
+
+  u = uniform01 (s);
+  if (t->dist == DIST_UNIFORM)
+    return t->sigma*(2.0*u-1.0);
+  v = uniform01 (s);
+  return t->sigma*sqrt (-2.0*log (u))*cos (2.0*PI*v);
+}
+
+/* Perturb c[] for sample k, storing the new field values in val[] */
+static void perturb (const mc_state *mc, conductor *c, int k, double *val)
+{
+  const tolerance *t;
+  uint64_t s;
+  int j, i, i1, i2, n;
+  double d, w;
+
+  s = (uint64_t) mc->seed*0x100000001b3ULL+(uint64_t) k;
+  n = 0;
+  for (j=0;j<mc->ntol;j++)
+    {
+      t = &mc->tol[j];
+      i1 = t->cond < 0 ? 1 : t->cond;
+      i2 = t->cond < 0 ? mc->N : t->cond;
+      for (i=i1;i<=i2;i++)
+        {
+          d = draw (&s, t);
+          switch (t->field)
+            {
+            case SWEEP_X:
+              val[n++] = c[i].x += d;
+              break;
+            case SWEEP_Y:
+              val[n++] = c[i].y += d;
+              break;
+            case SWEEP_W:
+              /* etching keeps the centre of the trace */
+              w = fmax (c[i].w+d, 0.1*mc->nominal[i].w);
+              c[i].x -= 0.5*(w-c[i].w);
+              val[n++] = c[i].w = w;
+              break;
+            default:
+              val[n++] = c[i].h = fmax (c[i].h+d, 0.1*mc->nominal[i].h);
+              break;
+            }
+        }
+    }
+}
+
+static int same_element (const element *a, const element *b)
+{
+  return a->x1 == b->x1 && a->x2 == b->x2 && a->y1 == b->y1 &&
+         a->y2 == b->y2;
+}
+
+/* Solve one mesh at every frequency, storing R and L of sample k */
+static void mc_solve (mc_state *mc, int k, const MAT *L, ZMAT *Z, PERM *pivot,
+                      element *e, element e0, int n0, conductor *c)
+{
+  ZMAT *y;
+  int f, i, j, N;
+  double Omega, *R, *Lr;
+
+  N = mc->N;
+  for (f=0;f<mc->nfreq;f++)
+    {
+      Omega = 2.0*PI*mc->freq[f];
+      calcz (Z, L, e, n0, Omega, e0, c, N);
+      port_factor (Z, pivot);
+      y = port_reduce (Z, pivot, n0, c, N, ZMNULL);
+      y = port_inverse (y, y);
+      R = mc->R+((size_t) k*mc->nfreq+f)*N*N;
+      Lr = mc->L+((size_t) k*mc->nfreq+f)*N*N;
+      for (i=0;i<N;i++)
+        for (j=0;j<N;j++)
+          {
+            R[i*N+j] = y->me[i][j].re;
+            Lr[i*N+j] = y->me[i][j].im/Omega;
+          }
+      ZM_FREE (y);
+    }
+}
+
+static void *mc_worker (void *arg)
+{
+  mc_state *mc = (mc_state *) arg;
+  conductor *c;
+  element *e, e0;
+  MAT *Lw, *Lf;
+  ZMAT *Z, *Zf;
+  PERM *pivot, *pf;
+  int *S, *Sp, *St, s, sp, i, j, k, M, m, n0;
+
+  prof_attach (mc->prof);
+  TRACE_THREAD ("monte carlo worker");
+  M = mc->M;
+  c = (conductor *) Malloc ((mc->N+1)*sizeof (conductor));
+  Lw = m_get (M, M);
+  for (i=0;i<M;i++)
+    memcpy (Lw->me[i], mc->L0->me[i], M*sizeof (Real));
+  Z = zm_get (M, M);
+  pivot = px_get (M);
+  S = (int *) Malloc (M*sizeof (int));
+  Sp = (int *) Malloc (M*sizeof (int));
+  sp = 0;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&mc->lock);
+      k = mc->next++;
+      pthread_mutex_unlock (&mc->lock);
+      if (k >= mc->samples)
+        break;
+
+      TRACE_BEGIN ("sample", k);
+      memcpy (c, mc->nominal, (mc->N+1)*sizeof (conductor));
+      perturb (mc, c, k, mc->val+(size_t) k*mc->nval);
+      e = mesh_conductors (mc->N, c, &e0, &m, &n0);
+      if (e == NULL)
+        {
+          pthread_mutex_lock (&mc->lock);
+          if (!mc->failed)
+            fprintf (stderr, "\nERROR: sample %d can not be meshed", k);
+          mc->failed = 1;
+          mc->next = mc->samples;
+          pthread_mutex_unlock (&mc->lock);
+          TRACE_END ("sample");
+          break;
+        }
+
+      if (m == M && n0 == mc->n0 && same_element (&e0, &mc->e0))
+        {
+          /* back to the nominal rows, then redo the perturbed ones */
+          for (s=0;s<sp;s++)
+            for (j=0;j<M;j++)
+              {
+                Lw->me[Sp[s]][j] = mc->L0->me[Sp[s]][j];
+                Lw->me[j][Sp[s]] = mc->L0->me[j][Sp[s]];
+              }
+          s = 0;
+          for (i=0;i<M;i++)
+            if (!same_element (&e[i], &mc->e[i]))
+              S[s++] = i;
+          calclp_rows (Lw, e, e0, S, s);
+          St = Sp;
+          Sp = S;
+          S = St;
+          sp = s;
+          mc_solve (mc, k, Lw, Z, pivot, e, e0, n0, c);
+        }
+      else
+        {
+          Lf = m_get (m, m);
+          calclp (Lf, e, e0);
+          Zf = zm_get (m, m);
+          pf = px_get (m);
+          mc_solve (mc, k, Lf, Zf, pf, e, e0, n0, c);
+          PX_FREE (pf);
+          ZM_FREE (Zf);
+          M_FREE (Lf);
+          pthread_mutex_lock (&mc->lock);
+          mc->refills++;
+          pthread_mutex_unlock (&mc->lock);
+        }
+      Free (e);
+      TRACE_END ("sample");
+
+      pthread_mutex_lock (&mc->lock);
+      mc->done++;
+      if (mc->done % (mc->samples >= 10 ? mc->samples/10 : 1) == 0)
+        fprintf (stderr, "\n  %d of %d samples", mc->done, mc->samples);
+      pthread_mutex_unlock (&mc->lock);
+    }
+
+  Free (S);
+  Free (Sp);
+  PX_FREE (pivot);
+  ZM_FREE (Z);
+  M_FREE (Lw);
+  Free (c);
+  prof_attach (NULL);
+  return NULL;
+}
+
+static int cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* One line of statistics over n values v[0], v[stride], ... */
+static void print_stats (FILE *out, const char *name, const double *v, int n,
+                         size_t stride, double *tmp)
+{
+  int k;
+  double mean, var;
+
+  mean = 0.0;
+  for (k=0;k<n;k++)
+    mean += tmp[k] = v[k*stride];
+  mean /= n;
+  var = 0.0;
+  for (k=0;k<n;k++)
+    var += (tmp[k]-mean)*(tmp[k]-mean);
+  var = n > 1 ? var/(n-1) : 0.0;
+  qsort (tmp, n, sizeof (double), cmp_double);
+  fprintf (out, "%-5s %+0.4e %+0.4e %+0.4e %+0.4e %+0.4e %+0.4e %+0.4e\n",
+           name, mean, sqrt (var), tmp[0], tmp[(int) (0.05*(n-1)+0.5)],
+           tmp[(int) (0.5*(n-1)+0.5)], tmp[(int) (0.95*(n-1)+0.5)],
+           tmp[n-1]);
+}
+
+static void write_samples (const mc_state *mc, const char *file)
+{
+  FILE *fp;
+  int k, f, i, j, t, n, N;
+  const tolerance *tl;
+  size_t o;
+
+  fp = fopen (file, "w");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "\nERROR: Can not write %s", file);
+      return;
+    }
+  N = mc->N;
+  fprintf (fp, "sample,frequency");
+  for (t=0;t<mc->ntol;t++)
+    {
+      tl = &mc->tol[t];
+      for (i=tl->cond < 0 ? 1 : tl->cond;i<=(tl->cond < 0 ? N : tl->cond);i++)
+        fprintf (fp, ",line%d.%s", i, field_name (tl->field));
+    }
+  for (i=0;i<N;i++)
+    for (j=0;j<N;j++)
+      fprintf (fp, ",R%d%d", i+1, j+1);
+  for (i=0;i<N;i++)
+    for (j=0;j<N;j++)
+      fprintf (fp, ",L%d%d", i+1, j+1);
+  fprintf (fp, "\n");
+
+  for (k=0;k<mc->samples;k++)
+    for (f=0;f<mc->nfreq;f++)
+      {
+        fprintf (fp, "%d,%.6e", k, mc->freq[f]);
+        for (n=0;n<mc->nval;n++)
+          fprintf (fp, ",%.6e", mc->val[(size_t) k*mc->nval+n]);
+        o = ((size_t) k*mc->nfreq+f)*N*N;
+        for (n=0;n<N*N;n++)
+          fprintf (fp, ",%.6e", mc->R[o+n]);
+        for (n=0;n<N*N;n++)
+          fprintf (fp, ",%.6e", mc->L[o+n]);
+        fprintf (fp, "\n");
+      }
+  fclose (fp);
+  fprintf (stderr, "\nSamples written to %s", file);
+}
+
+/* Run 'samples' perturbed solves of test[] and print their statistics.
+ * file, if not empty, receives every sample as CSV. The conductors of
+ * tol[] must be among line0..lineN (weeks_run checks them). Returns 0
+ * if a mesh could not be made.
+ */
+int monte_carlo (const weeks_ctx *ctx, conductor *test, int N,
+                  const tolerance *tol, int ntol, int samples,
+                  unsigned long seed, const char *file, const double *freq,
+                  int nfreq)
+{
+  mc_state mc;
+  pthread_t *tid;
+  prof *outer;
+  MAT *L0;
+  double *tmp;
+  char name[32];
+  int i, j, f, t, workers, ok;
+  size_t stride, o;
+
+  memset (&mc, 0, sizeof (mc));
+  mc.nominal = test;
+  mc.N = N;
+  mc.tol = tol;
+  mc.ntol = ntol;
+  for (t=0;t<ntol;t++)
+    mc.nval += tol[t].cond < 0 ? N : 1;
+  mc.freq = freq;
+  mc.nfreq = nfreq;
+  mc.seed = seed;
+  mc.samples = samples;
+
+  fprintf (stderr, "\n\nBuilding partial elements...");
+  mc.e = mesh_conductors (N, test, &mc.e0, &mc.M, &mc.n0);
+  if (mc.e == NULL)
+    return 0;
+  fprintf (stderr, "\nNumber of elements: %d", mc.M);
+  L0 = m_get (mc.M, mc.M);
+  calclp (L0, mc.e, mc.e0);
+  mc.L0 = L0;
+
+  mc.val = (double *) Malloc ((size_t) samples*(mc.nval > 0 ? mc.nval : 1)
+                              *sizeof (double));
+  mc.R = (double *) Malloc ((size_t) samples*nfreq*N*N*sizeof (double));
+  mc.L = (double *) Malloc ((size_t) samples*nfreq*N*N*sizeof (double));
+  mc.prof = prof_current ();
+  pthread_mutex_init (&mc.lock, NULL);
+
+  workers = sweep_workers (sweep_shared (mc.M),
+                           sweep_shared (mc.M)+sweep_per_worker (mc.M),
+                           samples, ctx->threads, ctx->memory_budget);
+  fprintf (stderr, "\n\nMonte Carlo: %d samples with %d worker(s):",
+           samples, workers);
+  tid = (pthread_t *) Malloc (workers*sizeof (pthread_t));
+  for (i=0;i<workers;i++)
+    if (pthread_create (&tid[i], NULL, mc_worker, &mc) != 0)
+      {
+        fprintf (stderr, "\nWARNING: Can not start Monte Carlo worker %d, going on with %d",
+                 i+1, i);
+        workers = i;
+        break;
+      }
+  /* Without any worker thread the samples are solved here */
+  if (workers == 0)
+    {
+      outer = prof_current ();
+      mc_worker (&mc);
+      prof_attach (outer);
+    }
+  for (i=0;i<workers;i++)
+    pthread_join (tid[i], NULL);
+  if (mc.refills > 0)
+    fprintf (stderr, "\n  %d sample(s) changed the element count, filled in full",
+             mc.refills);
+
+  ok = !mc.failed;
+  tmp = (double *) Malloc (samples*sizeof (double));
+  stride = (size_t) nfreq*N*N;
+  for (f=0;ok && f<nfreq;f++)
+    {
+      fprintf (ctx->out, "\n\n*** MONTE CARLO: %d samples at %.2f MHz ***\n\n",
+               samples, freq[f]/1e6);
+      fprintf (ctx->out, "%-5s %11s %11s %11s %11s %11s %11s %11s\n", "",
+               "mean", "std", "min", "p5", "median", "p95", "max");
+      for (i=0;i<N;i++)
+        for (j=i;j<N;j++)
+          {
+            o = (size_t) f*N*N+i*N+j;
+            sprintf (name, "R%d%d", i+1, j+1);
+            print_stats (ctx->out, name, mc.R+o, samples, stride, tmp);
+          }
+      for (i=0;i<N;i++)
+        for (j=i;j<N;j++)
+          {
+            o = (size_t) f*N*N+i*N+j;
+            sprintf (name, "L%d%d", i+1, j+1);
+            print_stats (ctx->out, name, mc.L+o, samples, stride, tmp);
+          }
+    }
+  if (ok && file != NULL && file[0] != '\0')
+    write_samples (&mc, file);
+
+  Free (tmp);
+  Free (tid);
+  pthread_mutex_destroy (&mc.lock);
+  Free (mc.val);
+  Free (mc.R);
+  Free (mc.L);
+  M_FREE (L0);
+  Free (mc.e);
+  return ok;
+}
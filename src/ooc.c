@@ -0,0 +1,591 @@
+/* ooc.c - out-of-core solves for meshes whose Z does not fit in memory
+ *
+ * The M x M matrices live in two scratch files on local disk, stored as
+ * column panels of W columns: panel K holds columns K*W .. K*W+W-1 for
+ * all M rows, row by row, so any run of rows of a panel is contiguous.
+ * Only one panel (M x W) and one tile (W x W) are held in memory.
+ *
+ * The real partial inductances are filled once, straight into the L
+ * file: the lower part of each panel is computed (with the same formula
+ * as calclp) and the upper part is the transpose of tiles of the panels
+ * already written. For every frequency Z = R + jwL is assembled panel by
+ * panel into the Z file and factored left-looking: panel K is read,
+ * brought up to date with every earlier panel J < K (streamed in tiles
+ * of W rows, the next tile announced to the kernel with
+ * posix_fadvise), factored in memory with the scaled partial pivoting
+ * of zLUfactor and written back. Its row interchanges are then applied
+ * to the earlier panels on disk. The N port solutions are computed by
+ * one streaming pass over the factors for each triangle.
+ *
+ * The factorization reads about 16 M^3/(3 W) bytes, so W is made as
+ * large as the memory budget allows.
+ *
+ * A failed read or write of the scratch files (a full disk) marks the
+ * solve as failed; the remaining panels are skipped and ooc_sweep
+ * returns 0 after the frequency points already reported.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "currents.h"
+#include "ooc.h"
+#include "prof.h"
+#include "trace.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+typedef struct {
+  int M, W, np;                 /* size, panel width, number of panels */
+  int Lfd, Zfd;
+  int *sw;                      /* row exchanged with row k at step k */
+  Real *scale;                  /* largest |Z| of each row */
+  complex *P, *T;               /* panel and tile buffers */
+  double in, out;               /* bytes read and written */
+  int failed;                   /* a read or write of the files failed */
+} ooc;
+
+static double now (void)
+{
+  return 1e-9*prof_now ();
+}
+
+static void ooc_read (ooc *o, int fd, void *buf, size_t n, off_t off)
+{
+  ssize_t r;
+
+  if (o->failed)
+    return;
+  o->in += n;
+  while (n > 0)
+    {
+      r = pread (fd, buf, n, off);
+      if (r <= 0)
+        {
+          fprintf (stderr, "\nERROR: out-of-core read failed");
+          o->failed = 1;
+          return;
+        }
+      buf = (char *) buf+r;
+      n -= r;
+      off += r;
+    }
+}
+
+static void ooc_write (ooc *o, int fd, const void *buf, size_t n, off_t off)
+{
+  ssize_t r;
+
+  if (o->failed)
+    return;
+  o->out += n;
+  while (n > 0)
+    {
+      r = pwrite (fd, buf, n, off);
+      if (r <= 0)
+        {
+          fprintf (stderr, "\nERROR: out-of-core write failed (disk full?)");
+          o->failed = 1;
+          return;
+        }
+      buf = (const char *) buf+r;
+      n -= r;
+      off += r;
+    }
+}
+
+/* Offset of row i of panel K in a file of 'size' byte entries */
+static off_t panel_offset (const ooc *o, int K, int i, size_t size)
+{
+  return ((off_t) K*o->M+i)*o->W*(off_t) size;
+}
+
+static int panel_width (const ooc *o, int K)
+{
+  return K < o->np-1 ? o->W : o->M-K*o->W;
+}
+
+/* Read rows r0 .. r0+n-1 of Z panel K into the tile, announcing the
+ * next n rows to the kernel
+ */
+static void read_tile (ooc *o, int K, int r0, int n)
+{
+  int next;
+
+  next = r0+n < o->M ? (r0+2*n <= o->M ? n : o->M-r0-n) : 0;
+  if (next > 0)
+    posix_fadvise (o->Zfd, panel_offset (o, K, r0+n, sizeof (complex)),
+                   (off_t) next*o->W*sizeof (complex), POSIX_FADV_WILLNEED);
+  ooc_read (o, o->Zfd, o->T, (size_t) n*o->W*sizeof (complex),
+            panel_offset (o, K, r0, sizeof (complex)));
+}
+
+/* Open an unlinked scratch file in dir, -1 if it can not be created */
+static int scratch_file (const char *dir)
+{
+  char path[512];
+  int fd;
+
+  snprintf (path, sizeof (path), "%s/weeks-ooc-XXXXXX",
+            dir[0] != '\0' ? dir : "/tmp");
+  fd = mkstemp (path);
+  if (fd < 0)
+    {
+      fprintf (stderr, "\nERROR: Can not create out-of-core file %s", path);
+      return -1;
+    }
+  unlink (path);
+  return fd;
+}
+
+/* Fill the L file, each entry as calclp computes it */
+static void ooc_fill_lp (ooc *o, element *e, element e0)
+{
+  Real *Lp, *Lt, *li0, *l0j, lmm;
+  int K, J, i, j, jj, a, b, w, wj, c0, image;
+
+  Lp = (Real *) Malloc ((size_t) o->M*o->W*sizeof (Real));
+  Lt = (Real *) Malloc ((size_t) o->W*o->W*sizeof (Real));
+  li0 = (Real *) Malloc (o->M*sizeof (Real));
+  l0j = (Real *) Malloc (o->M*sizeof (Real));
+  image = IMAGE_GROUND (e0);
+  if (!image)
+    {
+      lmm = lp (&e0, &e0);
+      for (i=0;i<o->M;i++)
+        {
+          li0[i] = lmm-lp (&e[i], &e0);
+          l0j[i] = lp (&e0, &e[i]);
+        }
+    }
+
+  for (K=0;K<o->np && !o->failed;K++)
+    {
+      TRACE_BEGIN ("fill panel", K);
+      c0 = K*o->W;
+      w = panel_width (o, K);
+      /* Upper part: transposed tiles of the earlier panels */
+      for (J=0;J<K;J++)
+        {
+          ooc_read (o, o->Lfd, Lt, (size_t) w*o->W*sizeof (Real),
+                    panel_offset (o, J, c0, sizeof (Real)));
+          wj = panel_width (o, J);
+          for (i=0;i<wj;i++)
+            for (jj=0;jj<w;jj++)
+              Lp[(size_t) (J*o->W+i)*o->W+jj] = Lt[(size_t) jj*o->W+i];
+        }
+      /* Lower part */
+      for (i=c0;i<o->M;i++)
+        for (jj=0;jj<w;jj++)
+          {
+            j = c0+jj;
+            a = i > j ? i : j;
+            b = i > j ? j : i;
+            Lp[(size_t) i*o->W+jj] = image ? lp_image (&e[a], &e[b], e0)
+                                    : li0[a]-l0j[b]+lp (&e[a], &e[b]);
+          }
+      ooc_write (o, o->Lfd, Lp, (size_t) o->M*o->W*sizeof (Real),
+                 panel_offset (o, K, 0, sizeof (Real)));
+      TRACE_END ("fill panel");
+    }
+  Free (l0j);
+  Free (li0);
+  Free (Lt);
+  Free (Lp);
+}
+
+/* Assemble Z = R + jwL into the Z file and set the row scales */
+static void ooc_assemble (ooc *o, element *e, int n0, double Omega,
+                          element e0, conductor *cond, int N)
+{
+  Real *Lp, r00, d;
+  complex *z;
+  int K, i, jj, w, c0;
+
+  Lp = (Real *) Malloc ((size_t) o->M*o->W*sizeof (Real));
+  r00 = calc_r00 (e0, Omega, cond);
+  for (i=0;i<o->M;i++)
+    o->scale[i] = 0.0;
+  for (K=0;K<o->np && !o->failed;K++)
+    {
+      c0 = K*o->W;
+      w = panel_width (o, K);
+      ooc_read (o, o->Lfd, Lp, (size_t) o->M*o->W*sizeof (Real),
+                panel_offset (o, K, 0, sizeof (Real)));
+      for (i=0;i<o->M;i++)
+        {
+          z = &o->P[(size_t) i*o->W];
+          for (jj=0;jj<w;jj++)
+            {
+              z[jj].re = r00;
+              z[jj].im = Omega*Lp[(size_t) i*o->W+jj];
+            }
+          if (i >= n0 && i >= c0 && i < c0+w)
+            z[i-c0].re += calc_element_loss (&e[i], Omega, cond, N);
+          for (jj=0;jj<w;jj++)
+            {
+              d = zabs (z[jj]);
+              if (d > o->scale[i])
+                o->scale[i] = d;
+            }
+        }
+      ooc_write (o, o->Zfd, o->P, (size_t) o->M*o->W*sizeof (complex),
+                 panel_offset (o, K, 0, sizeof (complex)));
+    }
+  Free (Lp);
+}
+
+static void swap_rows (complex *a, complex *b, int n)
+{
+  complex t;
+  int j;
+
+  for (j=0;j<n;j++)
+    {
+      t = a[j];
+      a[j] = b[j];
+      b[j] = t;
+    }
+}
+
+/* Left-looking LU of the Z file with the pivoting of zLUfactor */
+static void ooc_factor (ooc *o)
+{
+  complex *P, *T, *row, temp;
+  Real max1, d;
+  int K, J, i, k, q, r0, n, w, wj, c0, cj, kk, i_max;
+  off_t oa, ob;
+
+  P = o->P;
+  T = o->T;
+  for (K=0;K<o->np && !o->failed;K++)
+    {
+      TRACE_BEGIN ("factor panel", K);
+      c0 = K*o->W;
+      w = panel_width (o, K);
+      ooc_read (o, o->Zfd, P, (size_t) o->M*o->W*sizeof (complex),
+                panel_offset (o, K, 0, sizeof (complex)));
+      for (k=0;k<c0;k++)
+        if (o->sw[k] != k)
+          swap_rows (&P[(size_t) k*o->W], &P[(size_t) o->sw[k]*o->W], w);
+
+      /* Updates from the factored panels */
+      for (J=0;J<K && !o->failed;J++)
+        {
+          TRACE_BEGIN ("panel update", J);
+          cj = J*o->W;
+          wj = panel_width (o, J);
+          for (r0=cj;r0<o->M;r0+=n)
+            {
+              n = o->M-r0 < o->W ? o->M-r0 : o->W;
+              read_tile (o, J, r0, n);
+              for (i=r0;i<r0+n;i++)
+                {
+                  row = &T[(size_t) (i-r0)*o->W];
+                  for (q=0;q<wj && cj+q<i;q++)
+                    {
+                      temp.re = -row[q].re;
+                      temp.im = -row[q].im;
+                      __zmltadd__ (&P[(size_t) i*o->W],
+                                   &P[(size_t) (cj+q)*o->W], temp, w,
+                                   Z_NOCONJ);
+                    }
+                }
+            }
+          TRACE_END ("panel update");
+        }
+
+      /* Factor the panel below its top */
+      for (kk=0;kk<w;kk++)
+        {
+          k = c0+kk;
+          o->sw[k] = k;
+          max1 = 0.0;
+          i_max = -1;
+          for (i=k;i<o->M;i++)
+            if (o->scale[i] > 0.0)
+              {
+                d = zabs (P[(size_t) i*o->W+kk])/o->scale[i];
+                if (d > max1)
+                  {
+                    max1 = d;
+                    i_max = i;
+                  }
+              }
+          if (i_max == -1)
+            continue;
+          if (i_max != k)
+            {
+              o->sw[k] = i_max;
+              swap_rows (&P[(size_t) i_max*o->W], &P[(size_t) k*o->W], w);
+            }
+          for (i=k+1;i<o->M;i++)
+            {
+              temp = P[(size_t) i*o->W+kk] = zdiv (P[(size_t) i*o->W+kk],
+                                                   P[(size_t) k*o->W+kk]);
+              temp.re = -temp.re;
+              temp.im = -temp.im;
+              if (kk+1 < w)
+                __zmltadd__ (&P[(size_t) i*o->W+kk+1],
+                             &P[(size_t) k*o->W+kk+1], temp, w-kk-1,
+                             Z_NOCONJ);
+            }
+        }
+      ooc_write (o, o->Zfd, P, (size_t) o->M*o->W*sizeof (complex),
+                 panel_offset (o, K, 0, sizeof (complex)));
+
+      /* The earlier panels follow the new row order */
+      for (kk=0;kk<w;kk++)
+        {
+          k = c0+kk;
+          if (o->sw[k] == k)
+            continue;
+          for (J=0;J<K;J++)
+            {
+              oa = panel_offset (o, J, k, sizeof (complex));
+              ob = panel_offset (o, J, o->sw[k], sizeof (complex));
+              ooc_read (o, o->Zfd, T, o->W*sizeof (complex), oa);
+              ooc_read (o, o->Zfd, T+o->W, o->W*sizeof (complex), ob);
+              ooc_write (o, o->Zfd, T, o->W*sizeof (complex), ob);
+              ooc_write (o, o->Zfd, T+o->W, o->W*sizeof (complex), oa);
+            }
+        }
+      TRACE_END ("factor panel");
+    }
+}
+
+/* Solve Z X = B in place for the n right hand sides in B (M x n, row i
+ * at B+i*n)
+ */
+static void ooc_solve (ooc *o, complex *B, int n)
+{
+  complex *T, *row, c;
+  int K, i, k, q, r0, m, cj, wj;
+
+  T = o->T;
+  for (k=0;k<o->M;k++)
+    if (o->sw[k] != k)
+      swap_rows (&B[(size_t) k*n], &B[(size_t) o->sw[k]*n], n);
+
+  /* Unit lower triangle, top to bottom */
+  for (K=0;K<o->np && !o->failed;K++)
+    {
+      cj = K*o->W;
+      wj = panel_width (o, K);
+      for (r0=cj;r0<o->M;r0+=m)
+        {
+          m = o->M-r0 < o->W ? o->M-r0 : o->W;
+          read_tile (o, K, r0, m);
+          for (i=r0;i<r0+m;i++)
+            {
+              row = &T[(size_t) (i-r0)*o->W];
+              for (q=0;q<wj && cj+q<i;q++)
+                {
+                  c.re = -row[q].re;
+                  c.im = -row[q].im;
+                  __zmltadd__ (&B[(size_t) i*n], &B[(size_t) (cj+q)*n], c,
+                               n, Z_NOCONJ);
+                }
+            }
+        }
+    }
+
+  /* Upper triangle, bottom to top */
+  for (K=o->np-1;K>=0 && !o->failed;K--)
+    {
+      cj = K*o->W;
+      wj = panel_width (o, K);
+      read_tile (o, K, cj, wj);
+      for (i=wj-1;i>=0;i--)
+        {
+          row = &T[(size_t) i*o->W];
+          for (q=i+1;q<wj;q++)
+            {
+              c.re = -row[q].re;
+              c.im = -row[q].im;
+              __zmltadd__ (&B[(size_t) (cj+i)*n], &B[(size_t) (cj+q)*n], c,
+                           n, Z_NOCONJ);
+            }
+          for (q=0;q<n;q++)
+            B[(size_t) (cj+i)*n+q] = zdiv (B[(size_t) (cj+i)*n+q], row[i]);
+        }
+      for (r0=0;r0<cj;r0+=m)
+        {
+          m = cj-r0 < o->W ? cj-r0 : o->W;
+          read_tile (o, K, r0, m);
+          for (i=r0;i<r0+m;i++)
+            {
+              row = &T[(size_t) (i-r0)*o->W];
+              for (q=0;q<wj;q++)
+                {
+                  c.re = -row[q].re;
+                  c.im = -row[q].im;
+                  __zmltadd__ (&B[(size_t) i*n], &B[(size_t) (cj+q)*n], c,
+                               n, Z_NOCONJ);
+                }
+            }
+        }
+    }
+}
+
+/* Memory of an in-core sweep with one worker */
+static double in_core (int M)
+{
+  return sweep_shared (M)+sweep_per_worker (M);
+}
+
+static double budget (const weeks_ctx *ctx)
+{
+  if (ctx->memory_budget > 0.0)
+    return ctx->memory_budget;
+  return 0.5*(double) sysconf (_SC_PHYS_PAGES)*(double) sysconf (_SC_PAGESIZE);
+}
+
+/* 1 if an M element mesh should be solved out of core */
+int ooc_needed (const weeks_ctx *ctx, int M)
+{
+  if (ctx->out_of_core == OOC_ON)
+    return 1;
+  return ctx->out_of_core == OOC_AUTO && in_core (M) > budget (ctx);
+}
+
+/* Panel width: the panel and two tiles in half the budget */
+static int ooc_width (const weeks_ctx *ctx, int M)
+{
+  double b, W;
+
+  if (ctx->ooc_panel > 0)
+    return ctx->ooc_panel < M ? ctx->ooc_panel : M;
+  b = 0.5*budget (ctx)/sizeof (complex);
+  W = b/(M+2.0*sqrt (b));
+  if (W > M)
+    W = M;
+  if (W > 64)
+    W = 32*floor (W/32);
+  return W < 16 ? 16 : (int) W;
+}
+
+/* Solve every frequency point out of core and report it like sweep().
+ * Returns 0 if the scratch files could not be created, read or written.
+ */
+int ooc_sweep (const weeks_ctx *ctx, element *e, element e0, int M, int n0,
+                conductor *cond, int N, const double *freq, int nfreq,
+                sweep_report report, void *arg)
+{
+  ooc o;
+  complex *B;
+  ZMAT *X, *y;
+  double t, tf, tl, ts, in, out, Omega;
+  uint64_t t0;
+  int f, i, j, k, tk;
+
+  memset (&o, 0, sizeof (o));
+  o.M = M;
+  o.W = ooc_width (ctx, M);
+  o.np = (M+o.W-1)/o.W;
+  o.Lfd = scratch_file (ctx->ooc_dir);
+  o.Zfd = o.Lfd < 0 ? -1 : scratch_file (ctx->ooc_dir);
+  if (o.Zfd < 0)
+    {
+      if (o.Lfd >= 0)
+        close (o.Lfd);
+      return 0;
+    }
+  o.sw = (int *) Malloc (M*sizeof (int));
+  o.scale = (Real *) Malloc (M*sizeof (Real));
+  o.P = (complex *) Malloc ((size_t) M*o.W*sizeof (complex));
+  o.T = (complex *) Malloc ((size_t) 2*o.W*o.W*sizeof (complex));
+  B = (complex *) Malloc ((size_t) M*N*sizeof (complex));
+
+  fprintf (stderr, "\n\nOut of core: %d panels of %d columns, %.1f MB in memory, %.1f MB on disk",
+           o.np, o.W, ((double) M*o.W+2.0*o.W*o.W)*sizeof (complex)/1e6,
+           (double) M*o.np*o.W*(sizeof (Real)+sizeof (complex))/1e6);
+
+  t0 = prof_begin ();
+  t = now ();
+  ooc_fill_lp (&o, e, e0);
+  prof_add (PROF_FILL, t0);
+  fprintf (stderr, "\n  Lp fill: %.1f s, %.1f MB written", now ()-t,
+           o.out/1e6);
+
+  for (f=0;f<nfreq && !o.failed;f++)
+    {
+      TRACE_BEGIN ("point", freq[f]);
+      Omega = 2.0*PI*freq[f];
+      in = o.in;
+      out = o.out;
+      t0 = prof_begin ();
+      t = now ();
+      ooc_assemble (&o, e, n0, Omega, e0, cond, N);
+      prof_add (PROF_ASSEMBLE, t0);
+      t0 = prof_begin ();
+      tl = now ();
+      ooc_factor (&o);
+      prof_count (PROF_FLOPS, PROF_LU_FLOPS (M));
+      prof_add (PROF_FACTOR, t0);
+      tf = now ();
+
+      memset (B, 0, (size_t) M*N*sizeof (complex));
+      tk = n0;
+      for (k=0;k<N;k++)
+        {
+          for (j=0;j<cond[k+1].n;j++)
+            B[(size_t) (tk+j)*N+k].re = 1.0;
+          tk += cond[k+1].n;
+        }
+      t0 = prof_begin ();
+      ooc_solve (&o, B, N);
+      prof_count (PROF_FLOPS, PROF_SOLVE_FLOPS (M, N));
+      prof_add (PROF_SOLVE, t0);
+      ts = now ();
+      if (o.failed)
+        {
+          TRACE_END ("point");
+          break;
+        }
+
+      fprintf (stderr, "\n  %.3e Hz: assemble %.1f s, factor %.1f s (%.2f GFLOP/s), solve %.1f s, I/O %.1f MB/s",
+               freq[f], tl-t, tf-tl,
+               8.0/3.0*(double) M*M*M/(tf-tl)/1e9, ts-tf,
+               (o.in-in+o.out-out)/(ts-t)/1e6);
+
+      X = zm_get (M, N);
+      for (i=0;i<M;i++)
+        for (k=0;k<N;k++)
+          X->me[i][k] = B[(size_t) i*N+k];
+      y = port_sum (X, n0, cond, N, ZMNULL);
+      report (port_inverse (y, ZMNULL), y, freq[f], N, arg);
+      ZM_FREE (y);
+      cur_write (ctx->cur, X, e, e0, n0, cond, N, freq[f]);
+      ZM_FREE (X);
+      TRACE_END ("point");
+    }
+  fprintf (stderr, "\n  Total I/O: %.1f MB read, %.1f MB written",
+           o.in/1e6, o.out/1e6);
+  prof_count (PROF_IO_READ, o.in);
+  prof_count (PROF_IO_WRITE, o.out);
+
+  Free (B);
+  Free (o.T);
+  Free (o.P);
+  Free (o.scale);
+  Free (o.sw);
+  close (o.Zfd);
+  close (o.Lfd);
+  return !o.failed;
+}
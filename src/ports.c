@@ -0,0 +1,121 @@
+/* ports.c - other port groupings of the conductor admittance
+ *
+ * port_reduce gives the admittance y between the signal lines with line0
+ * as the return. Any grouping that ties whole conductors together, picks
+ * other conductors as the reference or leaves some open is a linear
+ * combination of those N solutions, so it is an N x N reduction of y and
+ * needs no further solves with the factored Z. Every grouping of the
+ * input is evaluated this way for each result.
+ */
+
+#include <stdio.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "ports.h"
+#include "mf.h"
+
+/* Entry (c, d) of the indefinite admittance of the conductors 0..N,
+ * whose line0 row and column make every row and column sum to zero
+ */
+static complex indefinite (ZMAT *y, int N, int c, int d)
+{
+  complex s;
+  int i, j;
+
+  if (c > 0 && d > 0)
+    return y->me[c-1][d-1];
+  s.re = s.im = 0.0;
+  for (i=0;i<N;i++)
+    for (j=0;j<N;j++)
+      if ((c == 0 || i == c-1) && (d == 0 || j == d-1))
+        {
+          s.re += y->me[i][j].re;
+          s.im += y->me[i][j].im;
+        }
+  if (c+d > 0)
+    {
+      s.re = -s.re;
+      s.im = -s.im;
+    }
+  return s;
+}
+
+/* 1 if every port and the reference of g hold a conductor of 0..N and
+ * no other conductor is named
+ */
+int port_group_check (const port_group *g, int N)
+{
+  int c, p, n;
+
+  for (c=N+1;c<MAX_CONDUCTORS;c++)
+    if (g->port[c] != PORT_FLOATING)
+      return 0;
+  for (p=PORT_REFERENCE;p<=g->nport;p++)
+    {
+      n = 0;
+      for (c=0;c<=N;c++)
+        n += g->port[c] == p;
+      if (n == 0)
+        return 0;
+    }
+  return 1;
+}
+
+/* Port impedance of the grouping g from the N x N conductor admittance
+ * y of port_reduce (one port per signal line against line0). Conductors
+ * of one port share its voltage, the reference conductors are at zero
+ * and floating ones are eliminated with zero net current. Since a port
+ * is a sum of whole conductors, no further solves with Z are needed.
+ */
+ZMAT *port_group_z (ZMAT *y, const port_group *g, int N, ZMAT *z)
+{
+  int node[MAX_CONDUCTORS];
+  int c, d, i, j, k, l, np, nn;
+  ZMAT *Yn, *Fi, *Yp;
+  complex s;
+
+  np = g->nport;
+  nn = np;
+  for (c=0;c<=N;c++)
+    if (g->port[c] == PORT_FLOATING)
+      node[c] = nn++;
+    else
+      node[c] = g->port[c]-1;
+
+  Yn = zm_get (nn, nn);
+  for (c=0;c<=N;c++)
+    for (d=0;d<=N;d++)
+      if (node[c] >= 0 && node[d] >= 0)
+        {
+          s = indefinite (y, N, c, d);
+          Yn->me[node[c]][node[d]].re += s.re;
+          Yn->me[node[c]][node[d]].im += s.im;
+        }
+
+  /* Yp = Ypp - Ypf Yff^-1 Yfp */
+  Yp = zm_get (np, np);
+  for (i=0;i<np;i++)
+    for (j=0;j<np;j++)
+      Yp->me[i][j] = Yn->me[i][j];
+  if (nn > np)
+    {
+      Fi = zm_get (nn-np, nn-np);
+      for (k=0;k<nn-np;k++)
+        for (l=0;l<nn-np;l++)
+          Fi->me[k][l] = Yn->me[np+k][np+l];
+      Fi = zm_inverse (Fi, Fi);
+      for (i=0;i<np;i++)
+        for (j=0;j<np;j++)
+          for (k=0;k<nn-np;k++)
+            for (l=0;l<nn-np;l++)
+              Yp->me[i][j] = zsub (Yp->me[i][j],
+                                   zmlt (zmlt (Yn->me[i][np+k], Fi->me[k][l]),
+                                         Yn->me[np+l][j]));
+      ZM_FREE (Fi);
+    }
+
+  z = zm_inverse (Yp, z);
+  ZM_FREE (Yp);
+  ZM_FREE (Yn);
+  return z;
+}
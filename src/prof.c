@@ -0,0 +1,438 @@
+/* prof.c - per run timers and counters
+ *
+ * A run with ctx->profile_file has a prof from weeks_read or weeks_run
+ * on. The threads that work on it attach it (weeks_run for its own
+ * thread, the sweep and Monte Carlo workers for theirs), and the solver
+ * adds the time of each phase and its counters to whatever profile the
+ * calling thread has attached. Without one, a phase costs two reads of
+ * the monotonic clock and nothing is kept.
+ *
+ * lp() only increments a thread local count, which is added to the
+ * profile at the end of the next phase of that thread, so the inner
+ * loops of the fill take no atomic operations.
+ *
+ * In a build with tracing every phase is also a complete event on the
+ * timeline of trace.c.
+ *
+ * With hw_counters every thread that works on the run also counts its
+ * own cycles, instructions and last level cache references and misses
+ * (perf_event_open, user space only). The counters are opened on its
+ * first phase and closed when it detaches the profile, and a phase
+ * started with prof_begin gets the counts from there to its prof_add.
+ * Where the kernel or the CPU (most virtual machines) has no such
+ * counters the first failure is reported once and the phases are only
+ * timed. There is no portable event for floating point operations, so
+ * flops stay the estimate from the matrix sizes.
+ *
+ * At the end of the run one JSON object is appended to the profile file
+ * as a single line:
+ *
+ *   {"deck":"test.yaml","status":"ok","wall_ns":...,
+ *    "phases":{"parse":{"ns":...,"calls":...},...},
+ *    "lp_calls":...,"flops":...,"io_read_bytes":...,
+ *    "io_write_bytes":...,"elements":...,
+ *    "peak_counted_bytes":...,"peak_rss_bytes":...,
+ *    "hw":{"fill":{"ns":...,"cycles":...,"instructions":...,
+ *                  "cache_refs":...,"cache_misses":...,"ipc":...,
+ *                  "miss_bytes_per_s":...},...}}
+ *
+ * The two peaks are of the whole process: the largest number of bytes
+ * counted by mf.c, matrices included, and the peak resident set size
+ * reported by the kernel. For concurrent runs in one process they cover
+ * all of them. "hw" is only there with hw_counters, null if no counter
+ * could be opened, and lists the phases that were counted. Its rates are
+ * per thread, over the summed time of the phase.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "prof.h"
+#include "trace.h"
+#include "mf.h"
+
+static const char *phase_name[PROF_NPHASE] = {
+  "parse", "mesh", "fill", "assemble", "factor", "solve", "reduce"
+};
+
+__thread uint64_t prof_lp_calls;
+
+static const char *hw_name[PROF_NHW] = {
+  "cycles", "instructions", "cache_refs", "cache_misses"
+};
+
+static __thread prof *current;
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hardware counters of this thread and their readings at the start of
+ * its open phases, innermost last
+ */
+#define HW_DEPTH 8
+
+static __thread int hw_open;
+static __thread int hw_fd[PROF_NHW];
+static __thread int hw_depth;
+static __thread struct {
+  uint64_t t0;
+  uint64_t v[PROF_NHW];
+} hw_start[HW_DEPTH];
+static int hw_broken;           /* an open failed, do not try again */
+
+/* Monotonic clock in nanoseconds */
+uint64_t prof_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec*1000000000u+ts.tv_nsec;
+}
+
+prof *prof_create (const char *deck)
+{
+  prof *p;
+
+  p = (prof *) Calloc (1, sizeof (prof));
+  if (deck != NULL)
+    strncpy (p->deck, deck, sizeof (p->deck)-1);
+  p->start = prof_now ();
+  return p;
+}
+
+static void hw_close (void)
+{
+#ifdef __linux__
+  int i;
+
+  for (i=0;i<PROF_NHW;i++)
+    close (hw_fd[i]);
+#endif
+  hw_open = 0;
+  hw_depth = 0;
+}
+
+/* Open the counters of this thread as one group, so that they are on
+ * the CPU together
+ */
+static void hw_init (void)
+{
+#ifdef __linux__
+  static const uint64_t config[PROF_NHW] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES
+  };
+  struct perf_event_attr a;
+  int i, j, e;
+
+  for (i=0;i<PROF_NHW;i++)
+    {
+      memset (&a, 0, sizeof (a));
+      a.size = sizeof (a);
+      a.type = PERF_TYPE_HARDWARE;
+      a.config = config[i];
+      a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                      PERF_FORMAT_TOTAL_TIME_RUNNING;
+      a.exclude_kernel = 1;
+      a.exclude_hv = 1;
+      hw_fd[i] = syscall (SYS_perf_event_open, &a, 0, -1,
+                          i ? hw_fd[0] : -1, PERF_FLAG_FD_CLOEXEC);
+      if (hw_fd[i] < 0)
+        {
+          e = errno;
+          for (j=0;j<i;j++)
+            close (hw_fd[j]);
+          if (!__atomic_exchange_n (&hw_broken, 1, __ATOMIC_RELAXED))
+            fprintf (stderr, "\nWARNING: no hardware counter for %s (%s), phases are only timed",
+                     hw_name[i], strerror (e));
+          return;
+        }
+    }
+  hw_open = 1;
+  hw_depth = 0;
+#else
+  if (!__atomic_exchange_n (&hw_broken, 1, __ATOMIC_RELAXED))
+    fprintf (stderr, "\nWARNING: no hardware counters on this system, phases are only timed");
+#endif
+}
+
+/* Current counts of this thread, scaled up if the group was not on the
+ * CPU all the time. Returns 0 if they can not be read.
+ */
+static int hw_read (uint64_t *v)
+{
+#ifdef __linux__
+  uint64_t buf[3+PROF_NHW];
+  double scale;
+  int i;
+
+  if (read (hw_fd[0], buf, sizeof (buf)) != (ssize_t) sizeof (buf) ||
+      buf[0] != PROF_NHW)
+    return 0;
+  scale = buf[2] > 0 && buf[2] < buf[1] ? (double) buf[1]/buf[2] : 1.0;
+  for (i=0;i<PROF_NHW;i++)
+    v[i] = (uint64_t) (scale*buf[3+i]);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* Add the counts since the prof_begin that returned t0 to phase. Phases
+ * started before it that never ended are dropped.
+ */
+static void hw_phase (int phase, uint64_t t0, uint64_t t)
+{
+  uint64_t v[PROF_NHW];
+  int i;
+
+  while (hw_depth > 0 && hw_start[hw_depth-1].t0 != t0)
+    hw_depth--;
+  if (hw_depth == 0 || !hw_read (v))
+    return;
+  hw_depth--;
+  for (i=0;i<PROF_NHW;i++)
+    __atomic_add_fetch (&current->hw_count[phase][i],
+                        v[i]-hw_start[hw_depth].v[i], __ATOMIC_RELAXED);
+  __atomic_add_fetch (&current->hw_ns[phase], t-t0, __ATOMIC_RELAXED);
+}
+
+/* Add the pending lp() calls of this thread to its profile */
+static void flush_lp (void)
+{
+  if (current != NULL && prof_lp_calls > 0)
+    __atomic_add_fetch (&current->count[PROF_LP], prof_lp_calls,
+                        __ATOMIC_RELAXED);
+  prof_lp_calls = 0;
+}
+
+/* Count the work of this thread in p (NULL: nowhere) from now on and
+ * return the profile it had
+ */
+prof *prof_attach (prof *p)
+{
+  prof *old = current;
+
+  flush_lp ();
+  if (hw_open)
+    hw_close ();
+  current = p;
+  return old;
+}
+
+prof *prof_current (void)
+{
+  return current;
+}
+
+/* Start of a phase: prof_now, after reading the hardware counters of
+ * this thread if its profile counts them
+ */
+uint64_t prof_begin (void)
+{
+  uint64_t t;
+
+  if (current == NULL || !current->hw)
+    return prof_now ();
+  if (!hw_open && !__atomic_load_n (&hw_broken, __ATOMIC_RELAXED))
+    hw_init ();
+  if (!hw_open || hw_depth == HW_DEPTH || !hw_read (hw_start[hw_depth].v))
+    return prof_now ();
+  t = prof_now ();
+  hw_start[hw_depth++].t0 = t;
+  return t;
+}
+
+/* Add the time since t0 (from prof_begin or prof_now) to phase */
+void prof_add (int phase, uint64_t t0)
+{
+  uint64_t t = prof_now ();
+
+#ifdef WEEKS_TRACE
+  trace_complete (phase_name[phase], t0, t);
+#endif
+  if (current == NULL)
+    {
+      prof_lp_calls = 0;
+      return;
+    }
+  __atomic_add_fetch (&current->ns[phase], t-t0, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&current->calls[phase], 1, __ATOMIC_RELAXED);
+  if (hw_open)
+    hw_phase (phase, t0, t);
+  flush_lp ();
+}
+
+void prof_count (int counter, double n)
+{
+  if (current != NULL)
+    __atomic_add_fetch (&current->count[counter], (uint64_t) n,
+                        __ATOMIC_RELAXED);
+}
+
+void prof_max (int counter, uint64_t n)
+{
+  uint64_t old;
+
+  if (current == NULL)
+    return;
+  old = __atomic_load_n (&current->count[counter], __ATOMIC_RELAXED);
+  while (n > old &&
+         !__atomic_compare_exchange_n (&current->count[counter], &old, n, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* Peak resident set size of the process in bytes */
+size_t prof_peak_rss (void)
+{
+  struct rusage ru;
+
+  if (getrusage (RUSAGE_SELF, &ru) != 0)
+    return 0;
+  return (size_t) ru.ru_maxrss*1024;
+}
+
+static void json_string (FILE *fp, const char *s)
+{
+  fputc ('"', fp);
+  for (; *s; s++)
+    if (*s == '"' || *s == '\\')
+      fprintf (fp, "\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      fprintf (fp, "\\u%04x", *s);
+    else
+      fputc (*s, fp);
+  fputc ('"', fp);
+}
+
+/* Time of the counted phases of p, 0 if none was counted */
+static uint64_t hw_total_ns (const prof *p)
+{
+  uint64_t ns = 0;
+  int i;
+
+  for (i=0;i<PROF_NPHASE;i++)
+    ns += p->hw_ns[i];
+  return ns;
+}
+
+static void write_hw (FILE *fp, const prof *p)
+{
+  const uint64_t *c;
+  int i, j, first;
+
+  if (hw_total_ns (p) == 0)
+    {
+      fprintf (fp, ",\"hw\":null");
+      return;
+    }
+  fprintf (fp, ",\"hw\":{");
+  first = 1;
+  for (i=0;i<PROF_NPHASE;i++)
+    {
+      if (p->hw_ns[i] == 0)
+        continue;
+      c = p->hw_count[i];
+      fprintf (fp, "%s\"%s\":{\"ns\":%llu", first ? "" : ",", phase_name[i],
+               (unsigned long long) p->hw_ns[i]);
+      for (j=0;j<PROF_NHW;j++)
+        fprintf (fp, ",\"%s\":%llu", hw_name[j], (unsigned long long) c[j]);
+      fprintf (fp, ",\"ipc\":%.3f,\"miss_bytes_per_s\":%.4g}",
+               c[PROF_CYCLES] ? (double) c[PROF_INSTRUCTIONS]/c[PROF_CYCLES] : 0.0,
+               1e9*PROF_LINE*(double) c[PROF_CACHE_MISSES]/p->hw_ns[i]);
+      first = 0;
+    }
+  fputc ('}', fp);
+}
+
+/* Append the record of p to file. Returns 0 if it can not be written. */
+int prof_write (const prof *p, const char *file, int ok)
+{
+  FILE *fp;
+  int i, r;
+
+  pthread_mutex_lock (&write_lock);
+  if ((fp = fopen (file, "a")) == NULL)
+    {
+      pthread_mutex_unlock (&write_lock);
+      fprintf (stderr, "\nERROR: Can not open profile file '%s'", file);
+      return 0;
+    }
+  fprintf (fp, "{\"deck\":");
+  json_string (fp, p->deck);
+  fprintf (fp, ",\"status\":\"%s\",\"wall_ns\":%llu,\"phases\":{",
+           ok ? "ok" : "failed", (unsigned long long) (prof_now ()-p->start));
+  for (i=0;i<PROF_NPHASE;i++)
+    fprintf (fp, "%s\"%s\":{\"ns\":%llu,\"calls\":%llu}", i ? "," : "",
+             phase_name[i], (unsigned long long) p->ns[i],
+             (unsigned long long) p->calls[i]);
+  fprintf (fp, "},\"lp_calls\":%llu,\"flops\":%llu,\"io_read_bytes\":%llu,"
+           "\"io_write_bytes\":%llu,\"elements\":%llu,"
+           "\"peak_counted_bytes\":%lu,\"peak_rss_bytes\":%lu",
+           (unsigned long long) p->count[PROF_LP],
+           (unsigned long long) p->count[PROF_FLOPS],
+           (unsigned long long) p->count[PROF_IO_READ],
+           (unsigned long long) p->count[PROF_IO_WRITE],
+           (unsigned long long) p->count[PROF_ELEMENTS],
+           (unsigned long) get_max_memory (),
+           (unsigned long) prof_peak_rss ());
+  if (p->hw)
+    write_hw (fp, p);
+  fprintf (fp, "}\n");
+  r = fclose (fp) == 0;
+  pthread_mutex_unlock (&write_lock);
+  return r;
+}
+
+/* Table of the counted phases of p with instructions per cycle, the
+ * share of last level cache references that missed and the bandwidth of
+ * those misses per thread. The flops per cycle of the factor and solve
+ * phases are from the estimated flops.
+ */
+void prof_print_hw (FILE *fp, const prof *p)
+{
+  const uint64_t *c;
+  uint64_t cycles;
+  int i;
+
+  if (hw_total_ns (p) == 0)
+    {
+      fprintf (fp, "\n\nHardware counters: not available");
+      return;
+    }
+  fprintf (fp, "\n\nHardware counters%s%s:", p->deck[0] ? " of " : "", p->deck);
+  fprintf (fp, "\n  %-9s %11s %13s %6s %11s %7s %10s", "phase", "cycles",
+           "instructions", "IPC", "LLC misses", "missed", "miss GB/s");
+  for (i=0;i<PROF_NPHASE;i++)
+    {
+      if (p->hw_ns[i] == 0)
+        continue;
+      c = p->hw_count[i];
+      fprintf (fp, "\n  %-9s %11.4g %13.4g %6.2f %11.4g %6.1f%% %10.3f",
+               phase_name[i], (double) c[PROF_CYCLES],
+               (double) c[PROF_INSTRUCTIONS],
+               c[PROF_CYCLES] ? (double) c[PROF_INSTRUCTIONS]/c[PROF_CYCLES] : 0.0,
+               (double) c[PROF_CACHE_MISSES],
+               c[PROF_CACHE_REFS] ? 100.0*c[PROF_CACHE_MISSES]/c[PROF_CACHE_REFS] : 0.0,
+               PROF_LINE*(double) c[PROF_CACHE_MISSES]/p->hw_ns[i]);
+    }
+  cycles = p->hw_count[PROF_FACTOR][PROF_CYCLES]+
+           p->hw_count[PROF_SOLVE][PROF_CYCLES];
+  if (cycles > 0 && p->count[PROF_FLOPS] > 0)
+    fprintf (fp, "\n  factor and solve: %.2f flops per cycle",
+             (double) p->count[PROF_FLOPS]/cycles);
+}
+
+void prof_free (prof *p)
+{
+  Free (p);
+}
@@ -0,0 +1,274 @@
+/* progress.c - progressive coarse-to-fine solves
+ *
+ * Solves the problem on a sequence of meshes, each with about half the
+ * element size of the one before and ending with the mesh from the
+ * input. Every level is reported as soon as it is done. From the second
+ * level on, Richardson extrapolation gives an estimate of the converged
+ * R and L with an error bar, and the run stops early once the error of
+ * every port entry at every frequency is below the tolerance (relative
+ * to the diagonal entry of the same row).
+ *
+ * Odd division counts and the minimum counts keep the refinement from
+ * being an exact halving, so the extrapolation uses the element size of
+ * each level as 1/sqrt(M) for its M elements. A level whose mesh is the
+ * same as the one before (every count at its minimum) adds nothing and
+ * is skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "progress.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+typedef struct {
+  ZMAT **z;          /* results of this level, one per frequency */
+  int k;             /* next frequency index */
+} level_results;
+
+static void collect (ZMAT *z, ZMAT *y, double f, int N, void *arg)
+{
+  level_results *r = (level_results *) arg;
+
+  r->z[r->k++] = z;
+}
+
+/* Halve the number of divisions 'halvings' times, keeping it odd */
+static int coarsen (int n, int halvings, int nmin)
+{
+  while (halvings-- > 0)
+    n = (n+1)/2;
+  if (n%2 == 0)
+    n++;
+  return n < nmin ? nmin : n;
+}
+
+/* Ratio of the changes between three levels of element sizes h[0..2]
+ * for convergence of order p, r^p for a constant refinement ratio r
+ */
+static double change_ratio (const double *h, double p)
+{
+  return (pow (h[0], p)-pow (h[1], p))/(pow (h[1], p)-pow (h[2], p));
+}
+
+/* Extrapolate the values q[0..n-1] of successive levels (coarse to fine)
+ * with element sizes h[0..n-1]. Three levels estimate the order of
+ * convergence, two levels assume first order.
+ */
+static double richardson (const double *q, const double *h, int n,
+                          double *err)
+{
+  double p, r, qx, a, b;
+  int i;
+
+  p = 1.0;
+  if (n >= 3 && q[n-2] != q[n-1])
+    {
+      r = (q[n-3]-q[n-2])/(q[n-2]-q[n-1]);
+      if (r > 1.0)
+        {
+          a = 0.5;
+          b = 4.0;
+          for (i=0; i<40; i++)
+            {
+              p = 0.5*(a+b);
+              if (change_ratio (&h[n-3], p) < r)
+                a = p;
+              else
+                b = p;
+            }
+        }
+    }
+  qx = q[n-1]+(q[n-1]-q[n-2])/(pow (h[n-2]/h[n-1], p)-1.0);
+  *err = fabs (qx-q[n-1]);
+  return qx;
+}
+
+/* Extrapolate the port impedance of frequency k over the first n levels,
+ * with element sizes h, into zx and its absolute error into ze. Returns
+ * the largest error relative to the diagonal.
+ */
+static double extrapolate (ZMAT ***zl, const double *h, int n, int k,
+                           ZMAT *zx, ZMAT *ze)
+{
+  int i, j, l;
+  double q[3], rel, worst;
+  int m;
+
+  m = n < 3 ? n : 3;
+  worst = 0.0;
+  for (i=0; i<zx->m; i++)
+    for (j=0; j<zx->n; j++)
+      {
+        for (l=0; l<m; l++)
+          q[l] = zl[n-m+l][k]->me[i][j].re;
+        zx->me[i][j].re = richardson (q, &h[n-m], m, &ze->me[i][j].re);
+        for (l=0; l<m; l++)
+          q[l] = zl[n-m+l][k]->me[i][j].im;
+        zx->me[i][j].im = richardson (q, &h[n-m], m, &ze->me[i][j].im);
+      }
+  for (i=0; i<zx->m; i++)
+    for (j=0; j<zx->n; j++)
+      {
+        rel = ze->me[i][j].re/fabs (zx->me[i][i].re);
+        if (rel > worst)
+          worst = rel;
+        rel = ze->me[i][j].im/fabs (zx->me[i][i].im);
+        if (rel > worst)
+          worst = rel;
+      }
+  return worst;
+}
+
+static void print_level (FILE *out, int l, int levels, int M, ZMAT **z,
+                         const double *freq, int nfreq, int N)
+{
+  int i, k;
+
+  fprintf (out, "\nLEVEL %d/%d (%d elements)\n", l+1, levels, M);
+  for (k=0; k<nfreq; k++)
+    {
+      fprintf (out, "  f=%e Hz", freq[k]);
+      for (i=0; i<N; i++)
+        fprintf (out, "  R%d%d=%+0.4e L%d%d=%+0.4e", i+1, i+1,
+                 z[k]->me[i][i].re, i+1, i+1,
+                 z[k]->me[i][i].im/(2.0*PI*freq[k]));
+      fprintf (out, "\n");
+    }
+}
+
+static void print_error (FILE *out, ZMAT *ze, double f, int N)
+{
+  int i, j;
+
+  fprintf(out, "\n*** ESTIMATED ERROR R (Ohm/m) / L (H/m) ***\n\n");
+  for(i=0;i<N;i++) {
+    fprintf (out, "%3d ",i+1);
+    for(j=0;j<N;j++)
+      fprintf(out, "%0.2e/%0.2e ",ze->me[i][j].re,ze->me[i][j].im/(2.0*PI*f));
+    fprintf(out, "\n");
+  }
+}
+
+/* Same division counts and ground columns in a and b */
+static int same_mesh (const conductor *a, const conductor *b, int N)
+{
+  int i;
+
+  for (i=0; i<=N; i++)
+    if (a[i].nw != b[i].nw || a[i].nh != b[i].nh)
+      return 0;
+  return a[0].gmin == b[0].gmin && a[0].gmax == b[0].gmax;
+}
+
+/* Run up to 'levels' meshes ending with the one in test[] and report the
+ * extrapolated port impedance of every frequency through 'report'.
+ * Returns 0 if a level could not be meshed.
+ */
+int progressive (const weeks_ctx *ctx, conductor *test, int N,
+                 const double *freq, int nfreq, int levels, double tol,
+                 sweep_report report, void *arg)
+{
+  conductor *lt, *prev;
+  element *e, e0;
+  ZMAT ***zl, *zx, *ze;
+  level_results r;
+  int i, l, k, n, M, n0, done, ok;
+  double err, worst, *h;
+
+  lt = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  prev = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  zl = (ZMAT ***) Calloc (levels, sizeof (ZMAT **));
+  h = (double *) Malloc (levels*sizeof (double));
+  n = done = 0;
+  ok = 1;
+  worst = HUGE_VAL;
+
+  for (l=0; l<levels; l++)
+    {
+      memcpy (lt, test, (N+1)*sizeof (conductor));
+      for (i=0; i<=N; i++)
+        {
+          lt[i].nw = coarsen (test[i].nw, levels-1-l, i == 0 ? 1 : 3);
+          lt[i].nh = coarsen (test[i].nh, levels-1-l, i == 0 ? 1 : 3);
+        }
+      lt[0].gmin = ldexp (test[0].gmin, levels-1-l);
+      lt[0].gmax = ldexp (test[0].gmax, levels-1-l);
+      if (n > 0 && same_mesh (lt, prev, N))
+        continue;
+      memcpy (prev, lt, (N+1)*sizeof (conductor));
+      e = mesh_conductors (N, lt, &e0, &M, &n0);
+      if (e == NULL)
+        {
+          ok = 0;
+          break;
+        }
+      zl[n] = (ZMAT **) Calloc (nfreq, sizeof (ZMAT *));
+      r.z = zl[n];
+      r.k = 0;
+      sweep_mesh (ctx, e, e0, M, n0, lt, N, freq, nfreq, collect, &r);
+      Free (e);
+      h[n] = 1.0/sqrt ((double) M);
+      print_level (ctx->out, l, levels, M, zl[n], freq, nfreq, N);
+      n++;
+      done = l+1;
+      if (n < 2)
+        continue;
+
+      worst = 0.0;
+      zx = zm_get (N, N);
+      ze = zm_get (N, N);
+      for (k=0; k<nfreq; k++)
+        {
+          err = extrapolate (zl, h, n, k, zx, ze);
+          if (err > worst)
+            worst = err;
+        }
+      ZM_FREE (zx);
+      ZM_FREE (ze);
+      fprintf (ctx->out, "  extrapolated relative error %.3e\n", worst);
+      if (worst < tol)
+        break;
+    }
+
+  if (ok && n >= 2 && worst < tol)
+    fprintf (ctx->out, "\nConverged to %.1e after %d of %d levels\n", tol,
+             done, levels);
+
+  for (k=0; ok && k<nfreq; k++)
+    {
+      if (n < 2)
+        {
+          report (zm_copy (zl[0][k], ZMNULL), ZMNULL, freq[k], N, arg);
+          continue;
+        }
+      zx = zm_get (N, N);
+      ze = zm_get (N, N);
+      extrapolate (zl, h, n, k, zx, ze);
+      report (zx, ZMNULL, freq[k], N, arg);
+      print_error (ctx->out, ze, freq[k], N);
+      ZM_FREE (ze);
+    }
+
+  for (l=0; l<n; l++)
+    {
+      for (k=0; k<nfreq; k++)
+        ZM_FREE (zl[l][k]);
+      Free (zl[l]);
+    }
+  Free (zl);
+  Free (h);
+  Free (lt);
+  Free (prev);
+  return ok;
+}
@@ -0,0 +1,119 @@
+/* reduce.c - port reduction of the factored element matrix
+ *
+ * The admittance between conductors i and k is the sum of the element
+ * admittances Y = Z^-1 over the rows of conductor i and the columns of
+ * conductor k. Instead of forming the full inverse (M solves) we solve
+ * Z x = b_k once per conductor, where b_k is one on the elements of
+ * conductor k, and sum x over the elements of every conductor (N solves).
+ *
+ * The solves are timed as the solve phase of the run (prof.c), the sums
+ * and the inversion to the port impedance as its reduce phase.
+ */
+
+#include <stdio.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "reduce.h"
+#include "prof.h"
+#include "mf.h"
+
+/* zLUfactor of the element matrix Z, timed as the factor phase */
+void port_factor (ZMAT *Z, PERM *pivot)
+{
+  uint64_t t;
+
+  t = prof_begin ();
+  zLUfactor (Z, pivot);
+  prof_count (PROF_FLOPS, PROF_LU_FLOPS (Z->m));
+  prof_add (PROF_FACTOR, t);
+}
+
+/* LU must hold the factorization of Z from zLUfactor. Elements of the
+ * signal conductors start at n0. Column k of the returned M x N matrix
+ * X holds the element currents for one volt on conductor k+1 and zero
+ * on the others.
+ */
+ZMAT *port_solutions (ZMAT *LU, PERM *pivot, int n0, conductor *test,
+                      int N, ZMAT *X)
+{
+  int j, k, tk;
+  ZVEC *b, *x;
+  uint64_t t;
+
+  t = prof_begin ();
+  X = zm_resize (X, LU->m, N);
+  b = zv_get (LU->m);
+  x = zv_get (LU->m);
+
+  tk = n0;
+  for (k=0;k<N;k++)
+    {
+      zv_zero (b);
+      for (j=0;j<test[k+1].n;j++)
+        b->ve[tk+j].re = 1.0;
+      zzLUsolve (LU, pivot, b, x);
+      zset_col (X, k, x);
+      tk += test[k+1].n;
+    }
+
+  ZV_FREE (b);
+  ZV_FREE (x);
+  prof_count (PROF_FLOPS, PROF_SOLVE_FLOPS (LU->m, N));
+  prof_add (PROF_SOLVE, t);
+  return X;
+}
+
+/* Sum the port solutions X over the elements of every signal conductor,
+ * giving the N x N admittance matrix in y (resized if needed).
+ */
+ZMAT *port_sum (ZMAT *X, int n0, conductor *test, int N, ZMAT *y)
+{
+  int i, j, k, ti;
+  uint64_t t;
+
+  t = prof_begin ();
+  y = zm_resize (y, N, N);
+  for (k=0;k<N;k++)
+    {
+      ti = n0;
+      for (i=0;i<N;i++)
+        {
+          y->me[i][k].re = 0.0;
+          y->me[i][k].im = 0.0;
+          for (j=0;j<test[i+1].n;j++)
+            {
+              y->me[i][k].re += X->me[ti+j][k].re;
+              y->me[i][k].im += X->me[ti+j][k].im;
+            }
+          ti += test[i+1].n;
+        }
+    }
+  prof_add (PROF_REDUCE, t);
+  return y;
+}
+
+/* Port admittance straight from the factorization */
+ZMAT *port_reduce (ZMAT *LU, PERM *pivot, int n0, conductor *test, int N,
+                   ZMAT *y)
+{
+  ZMAT *X;
+
+  X = port_solutions (LU, pivot, n0, test, N, ZMNULL);
+  y = port_sum (X, n0, test, N, y);
+  ZM_FREE (X);
+  return y;
+}
+
+/* Port impedance from the admittance y into z (resized if needed), in
+ * place if z is y
+ */
+ZMAT *port_inverse (ZMAT *y, ZMAT *z)
+{
+  uint64_t t;
+
+  t = prof_begin ();
+  z = zm_inverse (y, z);
+  prof_count (PROF_FLOPS, PROF_LU_FLOPS (z->m)+PROF_SOLVE_FLOPS (z->m, z->m));
+  prof_add (PROF_REDUCE, t);
+  return z;
+}
@@ -0,0 +1,295 @@
+/* rescache.c - stored port impedances of complete runs
+ *
+ * A run is described by the parsed conductors after mesh_setup (so an
+ * auto mesh is described by the mesh it chose), its frequencies and the
+ * settings that decide the solution: mesh, shell and ground options,
+ * adaptive refinement, symmetry and out-of-core mode. The
+ * description is a list of doubles, with -0.0 written as 0.0, so decks
+ * that differ only in the order of their keys or the spelling of their
+ * numbers get the same description. Threads, the memory budget and the
+ * out-of-core panel and directory only change how the system is solved
+ * and are left out, as are port groups and the listing, which are
+ * worked out from the stored impedances.
+ *
+ * The store is ctx->result_cache, one file per description named by
+ * its FNV-1a hash. The file holds the description, checked on every
+ * lookup, and the port impedances in the order they were reported:
+ *
+ *   "WEEKSRS1", uint32 length of the description, N and the number of
+ *   results, the description, then per result the frequency and the
+ *   N x N complex impedance, row by row
+ *
+ * A hit hands the stored impedances to the report callback and solves
+ * nothing. ctx->result_bypass solves anyway and replaces the stored
+ * result. Files are written under a temporary name and renamed, so
+ * concurrent runs may share the store.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "rescache.h"
+#include "mf.h"
+
+#define RC_MAGIC "WEEKSRS1"
+#define RC_VERSION 1.0
+
+struct rc_run {
+  const weeks_ctx *ctx;
+  int N;
+  double *key;            /* the description */
+  int nkey;
+  char name[1024];        /* file of the description */
+  void (*report) (ZMAT *, ZMAT *, double, int, void *);
+  void *arg;
+  int n;                  /* results kept by rc_keep */
+  double *f;
+  ZMAT **z;
+};
+
+/* Counts of this process */
+static int hits, misses, stored;
+static unsigned long tmp_count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void put (rc_run *r, double v)
+{
+  if ((r->nkey & 63) == 0)
+    r->key = (double *) Realloc (r->key, (r->nkey+64)*sizeof (double));
+  r->key[r->nkey++] = v+0.0;
+}
+
+static void describe (rc_run *r, const weeks_ctx *ctx,
+                      const conductor *cond, int N)
+{
+  const conductor *c;
+  int i;
+
+  put (r, RC_VERSION);
+  put (r, N);
+  for (i=0;i<=N;i++)
+    {
+      c = &cond[i];
+      put (r, c->w);
+      put (r, c->h);
+      put (r, c->x);
+      put (r, c->y);
+      put (r, c->b);
+      put (r, c->nw);
+      put (r, c->nh);
+      put (r, c->mesh);
+      put (r, c->shell);
+      put (r, c->gmin);
+      put (r, c->gmax);
+      put (r, c->grade);
+      put (r, c->er);
+      put (r, c->substrate_h);
+      put (r, c->tan_delta);
+    }
+  put (r, ctx->nfreq);
+  for (i=0;i<ctx->nfreq;i++)
+    put (r, ctx->frequencies[i]);
+  put (r, ctx->mesh);
+  put (r, ctx->adapt);
+  put (r, ctx->adapt_tolerance);
+  put (r, ctx->adapt_threshold);
+  put (r, ctx->adapt_iterations);
+  put (r, ctx->shell);
+  put (r, ctx->shell_frequency);
+  put (r, ctx->shell_depth);
+  put (r, ctx->symmetry);
+  put (r, ctx->out_of_core);
+  put (r, ctx->ground_mesh);
+  put (r, ctx->ground_min);
+  put (r, ctx->ground_max);
+  put (r, ctx->ground_grade);
+}
+
+/* Start a run of cond[0..N] that reports to report(arg). Returns NULL
+ * if ctx has no result store, the run writes more than impedances or it
+ * is incremental, whose results are not all N x N.
+ */
+rc_run *rc_begin (const weeks_ctx *ctx, const conductor *cond, int N,
+                  void (*report) (ZMAT *, ZMAT *, double, int, void *),
+                  void *arg)
+{
+  const unsigned char *p;
+  uint64_t h = 14695981039346656037ULL;
+  rc_run *r;
+  size_t i;
+
+  if (ctx->result_cache[0] == '\0' || ctx->cur != NULL || ctx->incremental)
+    return NULL;
+  r = (rc_run *) Calloc (1, sizeof (rc_run));
+  r->ctx = ctx;
+  r->N = N;
+  r->report = report;
+  r->arg = arg;
+  describe (r, ctx, cond, N);
+  p = (const unsigned char *) r->key;
+  for (i=0;i<r->nkey*sizeof (double);i++)
+    h = (h^p[i])*1099511628211ULL;
+  snprintf (r->name, sizeof (r->name), "%s/%016llx.res", ctx->result_cache,
+            (unsigned long long) h);
+  return r;
+}
+
+/* Report the stored result of the run. Returns 0 (and reports nothing)
+ * if there is none or the store is bypassed.
+ */
+int rc_replay (rc_run *r)
+{
+  char magic[8];
+  uint32_t h[3];
+  double *key, f;
+  ZMAT *z;
+  FILE *fp;
+  int ok, k, i, j;
+
+  if (r->ctx->result_bypass || (fp = fopen (r->name, "rb")) == NULL)
+    {
+      pthread_mutex_lock (&lock);
+      misses++;
+      pthread_mutex_unlock (&lock);
+      return 0;
+    }
+  key = (double *) Malloc (r->nkey*sizeof (double));
+  ok = fread (magic, 8, 1, fp) == 1 && memcmp (magic, RC_MAGIC, 8) == 0 &&
+       fread (h, sizeof (uint32_t), 3, fp) == 3 &&
+       h[0] == (uint32_t) r->nkey && h[1] == (uint32_t) r->N &&
+       fread (key, sizeof (double), r->nkey, fp) == (size_t) r->nkey &&
+       memcmp (key, r->key, r->nkey*sizeof (double)) == 0;
+  Free (key);
+
+  /* Read everything before reporting anything */
+  r->f = (double *) Calloc (ok ? h[2] : 1, sizeof (double));
+  r->z = (ZMAT **) Calloc (ok ? h[2] : 1, sizeof (ZMAT *));
+  for (k=0;ok && k<(int) h[2];k++)
+    {
+      ok = fread (&f, sizeof (double), 1, fp) == 1;
+      z = zm_get (r->N, r->N);
+      for (i=0;ok && i<r->N;i++)
+        for (j=0;ok && j<r->N;j++)
+          ok = fread (&z->me[i][j], sizeof (complex), 1, fp) == 1;
+      r->f[k] = f;
+      r->z[k] = z;
+      r->n = k+1;
+    }
+  fclose (fp);
+
+  pthread_mutex_lock (&lock);
+  if (ok)
+    hits++;
+  else
+    misses++;
+  pthread_mutex_unlock (&lock);
+  if (!ok)
+    {
+      /* another description with the same hash, or a damaged file */
+      for (k=0;k<r->n;k++)
+        ZM_FREE (r->z[k]);
+      r->n = 0;
+      return 0;
+    }
+
+  fprintf (stderr, "\n\nStored result %s: %d frequency point(s)", r->name,
+           r->n);
+  for (k=0;k<r->n;k++)
+    {
+      z = r->z[k];
+      r->z[k] = ZMNULL;
+      r->report (z, ZMNULL, r->f[k], r->N, r->arg);
+    }
+  r->n = 0;
+  return 1;
+}
+
+/* Report callback of a solve to be stored: keeps a copy of z and passes
+ * it on
+ */
+void rc_keep (ZMAT *z, ZMAT *y, double f, int N, void *arg)
+{
+  rc_run *r = (rc_run *) arg;
+
+  r->f = (double *) Realloc (r->f, (r->n+1)*sizeof (double));
+  r->z = (ZMAT **) Realloc (r->z, (r->n+1)*sizeof (ZMAT *));
+  r->f[r->n] = f;
+  r->z[r->n++] = zm_copy (z, ZMNULL);
+  r->report (z, y, f, N, r->arg);
+}
+
+/* Store the results kept by rc_keep */
+void rc_store (rc_run *r)
+{
+  char tmp[1100];
+  unsigned long id;
+  uint32_t h[3];
+  FILE *fp;
+  int ok, k, i;
+
+  pthread_mutex_lock (&lock);
+  id = ++tmp_count;
+  pthread_mutex_unlock (&lock);
+  mkdir (r->ctx->result_cache, 0777);
+  snprintf (tmp, sizeof (tmp), "%s.%d.%lu.tmp", r->name, (int) getpid (), id);
+  if ((fp = fopen (tmp, "wb")) == NULL)
+    {
+      fprintf (stderr, "\nWARNING: Can not write the result store %s",
+               r->ctx->result_cache);
+      return;
+    }
+  h[0] = r->nkey;
+  h[1] = r->N;
+  h[2] = r->n;
+  ok = fwrite (RC_MAGIC, 8, 1, fp) == 1 &&
+       fwrite (h, sizeof (uint32_t), 3, fp) == 3 &&
+       fwrite (r->key, sizeof (double), r->nkey, fp) == (size_t) r->nkey;
+  for (k=0;ok && k<r->n;k++)
+    {
+      ok = fwrite (&r->f[k], sizeof (double), 1, fp) == 1;
+      for (i=0;ok && i<r->N;i++)
+        ok = fwrite (r->z[k]->me[i], sizeof (complex), r->N, fp) ==
+             (size_t) r->N;
+    }
+  if (fclose (fp) != 0 || !ok || rename (tmp, r->name) != 0)
+    {
+      fprintf (stderr, "\nWARNING: Can not write %s", r->name);
+      unlink (tmp);
+      return;
+    }
+  pthread_mutex_lock (&lock);
+  stored++;
+  pthread_mutex_unlock (&lock);
+}
+
+void rc_end (rc_run *r)
+{
+  int k;
+
+  if (r == NULL)
+    return;
+  for (k=0;k<r->n;k++)
+    ZM_FREE (r->z[k]);
+  if (r->z)
+    Free (r->z);
+  if (r->f)
+    Free (r->f);
+  Free (r->key);
+  Free (r);
+}
+
+/* Lookups and stores of all runs of this process so far */
+void rc_stats (int *h, int *m, int *s)
+{
+  pthread_mutex_lock (&lock);
+  *h = hits;
+  *m = misses;
+  *s = stored;
+  pthread_mutex_unlock (&lock);
+}
@@ -0,0 +1,444 @@
+/* server.c - the solver as a daemon on a Unix domain socket
+ *
+ *   weeks-server [-s socket] [-j workers] [-c cache_bytes]
+ *                [-d cache_dir [-D dir_bytes]] [-p profile.json]
+ *                [-t trace.json] [-H]
+ *
+ * A client connects, sends one YAML deck and shuts down its sending
+ * side. The answer is the listing weeks would print for the deck,
+ * followed by the line
+ *
+ *   LATENCY queue=<ms> solve=<ms> total=<ms> status=ok|failed
+ *
+ * where queue is the time from accept to the start of the job. Every
+ * job is also logged on stdout, and with -p a job whose deck has no
+ * profile_file appends the profile of its run to that file. With -t
+ * a Chrome trace of all jobs (see trace.c) is written when the server
+ * stops. -H logs the hardware counters of every job, as hw_counters
+ * does.
+ *
+ * A fixed pool of workers and one Lp cache (lpcache.c) live as long as
+ * the server, so a deck that repeats or slightly edits an earlier one
+ * skips most of the fill. With -d the cache also keeps its matrices in
+ * that directory (see lpcache.c), for later servers and runs. Waiting
+ * jobs are served fairly between client processes (SO_PEERCRED): the
+ * next job is the oldest one of the client served least recently, so
+ * one client queueing many decks does not hold up the others.
+ *
+ * A deck must arrive within REQUEST_TIMEOUT seconds of its job being
+ * started, or the job fails; a client that never shuts down its side
+ * does not hold a worker. SIGINT and SIGTERM are taken by the accept
+ * loop only.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "symmetry.h"
+#include "lpcache.h"
+#include "libweeks.h"
+#include "trace.h"
+#include "mf.h"
+
+#define SERVER_SOCKET "/tmp/weeks.sock"
+#define MAX_REQUEST (16 << 20)
+#define REQUEST_TIMEOUT 30
+
+typedef struct job {
+  int fd;
+  pid_t pid;                /* client process */
+  unsigned long id;
+  double accepted;
+  struct job *next;
+} job;
+
+typedef struct {
+  pid_t pid;
+  unsigned long served;     /* server clock at its last job */
+} client;
+
+typedef struct {
+  job *head, *tail;         /* waiting jobs, oldest first */
+  client *cl;               /* clients with waiting jobs */
+  int ncl;
+  unsigned long clock;
+  int stop;
+  int threads;              /* sweep workers of a job without 'threads' */
+  lp_cache *lpc;
+  const char *profile;      /* -p, default profile_file or NULL */
+  int hw;                   /* -H, hardware counters of every job */
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+} server;
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal (int sig)
+{
+  stopping = 1;
+}
+
+static double now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec+1e-6*tv.tv_usec;
+}
+
+static client *find_client (server *s, pid_t pid)
+{
+  int i;
+
+  for (i=0;i<s->ncl;i++)
+    if (s->cl[i].pid == pid)
+      return &s->cl[i];
+  return NULL;
+}
+
+static void enqueue (server *s, job *j)
+{
+  pthread_mutex_lock (&s->lock);
+  j->next = NULL;
+  if (s->tail)
+    s->tail->next = j;
+  else
+    s->head = j;
+  s->tail = j;
+  if (find_client (s, j->pid) == NULL)
+    {
+      s->cl = (client *) Realloc (s->cl, (s->ncl+1)*sizeof (client));
+      s->cl[s->ncl].pid = j->pid;
+      s->cl[s->ncl].served = 0;
+      s->ncl++;
+    }
+  pthread_cond_signal (&s->work);
+  pthread_mutex_unlock (&s->lock);
+}
+
+/* Next job by the fair order, NULL once the server stops */
+static job *dequeue (server *s)
+{
+  job *j, **pp, **best;
+  client *c, *bc;
+
+  pthread_mutex_lock (&s->lock);
+  while (s->head == NULL && !s->stop)
+    pthread_cond_wait (&s->work, &s->lock);
+  if (s->head == NULL)
+    {
+      pthread_mutex_unlock (&s->lock);
+      return NULL;
+    }
+
+  best = NULL;
+  bc = NULL;
+  for (pp=&s->head;*pp;pp=&(*pp)->next)
+    {
+      c = find_client (s, (*pp)->pid);
+      if (bc == NULL || c->served < bc->served)
+        {
+          best = pp;
+          bc = c;
+        }
+    }
+  j = *best;
+  *best = j->next;
+  s->tail = NULL;
+  for (pp=&s->head;*pp;pp=&(*pp)->next)
+    s->tail = *pp;
+  bc->served = ++s->clock;
+
+  /* A client without waiting jobs starts afresh */
+  for (pp=&s->head;*pp && (*pp)->pid != j->pid;pp=&(*pp)->next)
+    ;
+  if (*pp == NULL)
+    *bc = s->cl[--s->ncl];
+  pthread_mutex_unlock (&s->lock);
+  return j;
+}
+
+/* Read the whole request. Returns its length, -1 on error, if it is
+ * too long or not complete after REQUEST_TIMEOUT seconds.
+ */
+static long read_request (int fd, char **buf)
+{
+  long n, cap, r;
+  double t0;
+
+  t0 = now ();
+  cap = 65536;
+  n = 0;
+  *buf = (char *) Malloc (cap);
+  for (;;)
+    {
+      if (n == cap)
+        {
+          if (cap >= MAX_REQUEST)
+            return -1;
+          cap *= 2;
+          *buf = (char *) Realloc (*buf, cap);
+        }
+      if (now ()-t0 > REQUEST_TIMEOUT)
+        return -1;
+      r = read (fd, *buf+n, cap-n);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r < 0)
+        return -1;
+      if (r == 0)
+        return n;
+      n += r;
+    }
+}
+
+static void run_job (server *s, job *j)
+{
+  weeks_ctx *ctx;
+  conductor *test;
+  FILE *in, *out;
+  char *buf, name[32];
+  double start, solved;
+  long n;
+  int N, ok, hits, partial, misses;
+  double bytes;
+
+  start = now ();
+  ok = 0;
+  buf = NULL;
+  out = fdopen (j->fd, "w");
+  ctx = weeks_create ();
+  if (s->profile != NULL)
+    strncpy (ctx->profile_file, s->profile, sizeof (ctx->profile_file)-1);
+  ctx->hw_counters = s->hw;
+  snprintf (name, sizeof (name), "job %lu", j->id);
+  n = out != NULL ? read_request (j->fd, &buf) : -1;
+  if (out != NULL && n < 0)
+    fprintf (out, "\nERROR: request not complete after %d s or over %d bytes\n",
+             REQUEST_TIMEOUT, MAX_REQUEST);
+  if (n > 0 && (in = fmemopen (buf, n, "r")) != NULL)
+    {
+      test = weeks_read (ctx, in, name, &N);
+      fclose (in);
+      if (test != NULL)
+        {
+          if (ctx->threads == 0)
+            ctx->threads = s->threads;
+          ctx->out = out;
+          ctx->lpc = s->lpc;
+          ok = weeks_run (ctx, test, N, weeks_report, ctx);
+          Free (test);
+        }
+    }
+  solved = now ();
+  weeks_destroy (ctx);
+  Free (buf);
+
+  if (out != NULL)
+    {
+      fprintf (out, "\nLATENCY queue=%.3f solve=%.3f total=%.3f status=%s\n",
+               1e3*(start-j->accepted), 1e3*(solved-start),
+               1e3*(solved-j->accepted), ok ? "ok" : "failed");
+      fclose (out);
+    }
+  else
+    close (j->fd);
+
+  lpc_stats (s->lpc, &hits, &partial, &misses, &bytes);
+  printf ("job %lu pid %d: %s, queue %.1f ms, solve %.1f ms; Lp cache %d hit, %d partial, %d miss, %.1f MB\n",
+          j->id, (int) j->pid, ok ? "ok" : "failed", 1e3*(start-j->accepted),
+          1e3*(solved-start), hits, partial, misses, bytes/1e6);
+}
+
+static void *server_worker (void *arg)
+{
+  server *s = (server *) arg;
+  job *j;
+
+  TRACE_THREAD ("server worker");
+  while ((j = dequeue (s)) != NULL)
+    {
+      TRACE_BEGIN ("job", j->id);
+      run_job (s, j);
+      TRACE_END ("job");
+      Free (j);
+    }
+  return NULL;
+}
+
+static void usage (void)
+{
+  fprintf (stderr, "Usage: weeks-server [-s socket] [-j workers] [-c cache_bytes]\n"
+                   "                    [-d cache_dir [-D dir_bytes]] [-p profile.json]\n"
+                   "                    [-t trace.json] [-H]\n");
+  exit (EXIT_FAILURE);
+}
+
+int main (int argc, char **argv)
+{
+  server s;
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  struct timeval tv;
+  struct ucred cred;
+  sigset_t sigs;
+  socklen_t len;
+  pthread_t *tid;
+  const char *path, *dir, *profile, *trace;
+  double cache, disk;
+  unsigned long id;
+  job *j;
+  int c, i, fd, lfd, workers, cpus, hw;
+
+  path = SERVER_SOCKET;
+  workers = 0;
+  cache = 1e9;
+  dir = NULL;
+  disk = 1e9;
+  profile = trace = NULL;
+  hw = 0;
+  while ((c = getopt (argc, argv, "s:j:c:d:D:p:t:H")) != -1)
+    switch (c)
+      {
+      case 's':
+        path = optarg;
+        break;
+      case 'j':
+        workers = atoi (optarg);
+        break;
+      case 'c':
+        cache = atof (optarg);
+        break;
+      case 'd':
+        dir = optarg;
+        break;
+      case 'D':
+        disk = atof (optarg);
+        break;
+      case 'p':
+        profile = optarg;
+        break;
+      case 't':
+        trace = optarg;
+        break;
+      case 'H':
+        hw = 1;
+        break;
+      default:
+        usage ();
+      }
+  cpus = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (workers <= 0)
+    workers = cpus;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      fprintf (stderr, "ERROR: socket path too long: %s\n", path);
+      exit (EXIT_FAILURE);
+    }
+  strcpy (addr.sun_path, path);
+  unlink (path);
+  if ((lfd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind (lfd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (lfd, 64) < 0)
+    {
+      fprintf (stderr, "ERROR: Can not listen on %s: %s\n", path,
+               strerror (errno));
+      exit (EXIT_FAILURE);
+    }
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = on_signal;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+  signal (SIGPIPE, SIG_IGN);
+
+  memset (&s, 0, sizeof (s));
+  s.threads = cpus/workers > 1 ? cpus/workers : 1;
+  s.lpc = lpc_create (cache);
+  s.profile = profile;
+  s.hw = hw;
+  if (dir != NULL && !lpc_persist (s.lpc, dir, disk))
+    exit (EXIT_FAILURE);
+  if (trace != NULL && !trace_start (trace))
+    exit (EXIT_FAILURE);
+  pthread_mutex_init (&s.lock, NULL);
+  pthread_cond_init (&s.work, NULL);
+  setbuf (stdout, (char *) NULL);
+  /* Workers inherit the blocked signals, so only this thread stops */
+  sigemptyset (&sigs);
+  sigaddset (&sigs, SIGINT);
+  sigaddset (&sigs, SIGTERM);
+  pthread_sigmask (SIG_BLOCK, &sigs, NULL);
+  tid = (pthread_t *) Malloc (workers*sizeof (pthread_t));
+  for (i=0;i<workers;i++)
+    if (pthread_create (&tid[i], NULL, server_worker, &s) != 0)
+      {
+        fprintf (stderr, "ERROR: Can not start server worker %d\n", i);
+        exit (EXIT_FAILURE);
+      }
+  pthread_sigmask (SIG_UNBLOCK, &sigs, NULL);
+  printf ("Listening on %s with %d worker(s), %.0f MB Lp cache\n", path,
+          workers, cache/1e6);
+
+  id = 0;
+  while (!stopping)
+    {
+      fd = accept (lfd, NULL, NULL);
+      if (fd < 0)
+        {
+          if (errno != EINTR)
+            perror ("accept");
+          continue;
+        }
+      tv.tv_sec = REQUEST_TIMEOUT;
+      tv.tv_usec = 0;
+      setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+      j = (job *) Malloc (sizeof (job));
+      j->fd = fd;
+      j->id = ++id;
+      j->accepted = now ();
+      len = sizeof (cred);
+      j->pid = getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 ?
+               cred.pid : 0;
+      enqueue (&s, j);
+    }
+
+  /* Finish the jobs already taken, drop the waiting ones */
+  close (lfd);
+  unlink (path);
+  pthread_mutex_lock (&s.lock);
+  s.stop = 1;
+  while ((j = s.head) != NULL)
+    {
+      s.head = j->next;
+      close (j->fd);
+      Free (j);
+    }
+  s.tail = NULL;
+  pthread_cond_broadcast (&s.work);
+  pthread_mutex_unlock (&s.lock);
+  for (i=0;i<workers;i++)
+    pthread_join (tid[i], NULL);
+  trace_stop ();
+
+  printf ("Stopped after %lu job(s)\n", id);
+  lpc_free (s.lpc);
+  Free (s.cl);
+  Free (tid);
+  pthread_mutex_destroy (&s.lock);
+  pthread_cond_destroy (&s.work);
+  return 0;
+}
@@ -0,0 +1,200 @@
+/* study.c - parametric geometry sweep with incremental reuse
+ *
+ * Runs every point of a sweep over conductor fields (x, y, w, h) in one
+ * process. The points are the Cartesian product of the value lists
+ * (the first parameter varies slowest) or, zipped, their i-th values
+ * taken together.
+ *
+ * Every point is meshed again, but only the elements that differ from
+ * the previous point are treated as changed. When the element count and
+ * e0 stay the same, calclp_rows redoes the Lp rows and columns of the
+ * changed elements only, and the factorization of every frequency is
+ * brought up to date by a low-rank update (lowrank.c), which factors
+ * again by itself once that is cheaper. A sweep that moves or resizes
+ * one conductor thus never recomputes the interactions of the others.
+ * Anything else (a new element count, e.g. from nw or a shell change,
+ * or a moved e0) fills and factors from scratch.
+ *
+ * The frequency points of a sweep point are done one after the other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "lowrank.h"
+#include "reduce.h"
+#include "study.h"
+#include "trace.h"
+#include "mf.h"
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+/* Number of points of the sweep */
+int study_points (const sweep_param *par, int npar, int zip)
+{
+  int j, n;
+
+  n = par[0].n;
+  for (j=1;j<npar;j++)
+    if (zip)
+      n = par[j].n < n ? par[j].n : n;
+    else
+      n *= par[j].n;
+  return n;
+}
+
+/* The conductor field swept by q */
+static double *field (conductor *c, const sweep_param *q)
+{
+  switch (q->field)
+    {
+    case SWEEP_X: return &c[q->cond].x;
+    case SWEEP_Y: return &c[q->cond].y;
+    case SWEEP_W: return &c[q->cond].w;
+    default:      return &c[q->cond].h;
+    }
+}
+
+/* Set the conductor fields of point p in c[] and print its values */
+static void set_point (FILE *out, conductor *c, const sweep_param *par,
+                       int npar, int zip, int p)
+{
+  int j, k;
+
+  for (j=npar-1;j>=0;j--)
+    {
+      if (zip)
+        k = p;
+      else
+        {
+          k = p % par[j].n;
+          p /= par[j].n;
+        }
+      *field (c, &par[j]) = par[j].v[k];
+    }
+  for (j=0;j<npar;j++)
+    fprintf (out, " line%d.%s=%.4e", par[j].cond, field_name (par[j].field),
+             *field (c, &par[j]));
+  fprintf (out, "\n");
+}
+
+static int same_element (const element *a, const element *b)
+{
+  return a->x1 == b->x1 && a->x2 == b->x2 && a->y1 == b->y1 &&
+         a->y2 == b->y2;
+}
+
+/* Solve every point of the sweep at every frequency. test[] is the
+ * geometry as read (and meshed) from the input; it is not changed. The
+ * conductors of par[] must be among line0..lineN (weeks_run checks
+ * them). Returns 0 if a point can not be meshed.
+ */
+int study (const weeks_ctx *ctx, conductor *test, int N,
+            const sweep_param *par, int npar, int zip, const double *freq,
+            int nfreq, sweep_report report, void *arg)
+{
+  conductor *work;
+  element *e, *ep, e0, e0p;
+  lowrank **lr;
+  MAT *L;
+  ZMAT *y;
+  int *S, j, k, p, np, M, Mp, n0, n0p, s, refill, ok;
+
+  np = study_points (par, npar, zip);
+  fprintf (stderr, "\n\nGeometry sweep: %d point(s) at %d frequency point(s)",
+           np, nfreq);
+
+  work = (conductor *) Malloc ((N+1)*sizeof (conductor));
+  memcpy (work, test, (N+1)*sizeof (conductor));
+  lr = (lowrank **) Calloc (nfreq, sizeof (lowrank *));
+  L = MNULL;
+  ep = NULL;
+  S = NULL;
+  Mp = n0p = 0;
+  e0p.x1 = e0p.x2 = e0p.y1 = e0p.y2 = 0.0;
+  ok = 1;
+
+  for (p=0;p<np;p++)
+    {
+      TRACE_BEGIN ("study point", p+1);
+      fprintf (ctx->out, "\n\nSWEEP POINT %d/%d:", p+1, np);
+      set_point (ctx->out, work, par, npar, zip, p);
+      e = mesh_conductors (N, work, &e0, &M, &n0);
+      if (e == NULL)
+        {
+          fprintf (stderr, "\nERROR: sweep point %d can not be meshed", p+1);
+          TRACE_END ("study point");
+          ok = 0;
+          break;
+        }
+
+      /* Elements that differ from the previous point */
+      s = 0;
+      refill = ep == NULL || M != Mp || n0 != n0p ||
+               !same_element (&e0, &e0p);
+      if (!refill)
+        {
+          for (j=0;j<M;j++)
+            if (!same_element (&e[j], &ep[j]))
+              S[s++] = j;
+          refill = 2*s > M;
+        }
+
+      if (refill)
+        {
+          fprintf (stderr, "\n  Point %d: %d elements, full fill", p+1, M);
+          L = m_resize (L, M, M);
+          calclp (L, e, e0);
+          S = (int *) Realloc (S, M*sizeof (int));
+          for (k=0;k<nfreq;k++)
+            {
+              if (lr[k])
+                lr_free (lr[k]);
+              lr[k] = lr_factor (L, e, e0, n0, work, N, 2.0*PI*freq[k]);
+            }
+        }
+      else
+        {
+          fprintf (stderr, "\n  Point %d: %d of %d elements changed", p+1,
+                   s, M);
+          if (s > 0)
+            {
+              calclp_rows (L, e, e0, S, s);
+              for (k=0;k<nfreq;k++)
+                if (!lr_update (lr[k], L, e, S, s) && k == 0)
+                  fprintf (stderr, ", refactored");
+            }
+        }
+
+      for (k=0;k<nfreq;k++)
+        {
+          y = lr_ports (lr[k], ZMNULL);
+          report (port_inverse (y, ZMNULL), y, freq[k], N, arg);
+          ZM_FREE (y);
+        }
+
+      if (ep)
+        Free (ep);
+      ep = e;
+      e0p = e0;
+      Mp = M;
+      n0p = n0;
+      TRACE_END ("study point");
+    }
+
+  for (k=0;k<nfreq;k++)
+    lr_free (lr[k]);
+  Free (lr);
+  Free (ep);
+  Free (S);
+  M_FREE (L);
+  Free (work);
+  return ok;
+}
@@ -0,0 +1,293 @@
+/* sweep.c - concurrent per-frequency solves sharing one Lp matrix
+ *
+ * The real partial inductance matrix from calclp does not depend on
+ * frequency. Every worker thread assembles and factors its own complex
+ * Z from that shared, read-only matrix, reduces it to the N x N port
+ * impedance and hands the result back. Frequency points are handed out
+ * in order and the calling thread reports them in order as they finish.
+ *
+ * A mirror symmetric mesh is solved as its even and odd halves instead
+ * (see symmetry.c); each worker then owns the two half size blocks.
+ *
+ * With a current density export open (currents.c) the workers keep the
+ * element currents of the port solutions, and the calling thread writes
+ * them after reporting each point.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "symmetry.h"
+#include "sweep.h"
+#include "currents.h"
+#include "lpcache.h"
+#include "prof.h"
+#include "trace.h"
+#include "mf.h"
+
+typedef struct {
+  const MAT *L;
+  const symmetry *sym;          /* if not NULL, used instead of L */
+  element *e;
+  element e0;
+  int n0, N;
+  conductor *cond;
+  const double *freq;
+  int nfreq;
+  int next;                     /* next frequency point to hand out */
+  ZMAT **z;                     /* results, NULL until finished */
+  ZMAT **y;                     /* the admittances they came from */
+  ZMAT **X;                     /* port solutions, only for an export */
+  prof *prof;                   /* of the calling thread */
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+} sweep_state;
+
+#ifndef PI
+#define PI 3.141592653589793116
+#endif
+
+/* Number of workers that fit in the memory budget. 'shared' bytes are
+ * used once (the real L), 'per_worker' bytes by each worker (its own
+ * complex Z). A budget <= 0 means half of the physical memory.
+ */
+int sweep_workers (double shared, double per_worker, int nfreq, int threads,
+                   double budget)
+{
+  int k;
+
+  if (threads <= 0)
+    threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (budget <= 0.0)
+    budget = 0.5 * (double) sysconf (_SC_PHYS_PAGES)
+             * (double) sysconf (_SC_PAGESIZE);
+
+  k = (int) ((budget - shared) / per_worker);
+
+  if (k > threads)
+    k = threads;
+  if (k > nfreq)
+    k = nfreq;
+  if (k < 1)
+    k = 1;
+  return k;
+}
+
+/* Memory of the full (non symmetric) sweep of an M element mesh */
+double sweep_shared (int M)
+{
+  return (double) M * M * sizeof (Real);
+}
+
+double sweep_per_worker (int M)
+{
+  return (double) M * M * sizeof (complex) + 4.0 * M * sizeof (complex);
+}
+
+static void *sweep_worker (void *arg)
+{
+  sweep_state *s = (sweep_state *) arg;
+  ZMAT *Z, *Zo, *y, *z, *X;
+  PERM *pivot, *po;
+  int k, m, mo;
+  double Omega;
+
+  prof_attach (s->prof);
+  TRACE_THREAD ("sweep worker");
+  m = s->sym ? s->sym->np+s->sym->ns : (int) s->L->m;
+  mo = s->sym && s->sym->np > 0 ? s->sym->np : 1;
+  Z = zm_get (m, m);
+  pivot = px_get (m);
+  Zo = s->sym ? zm_get (mo, mo) : ZMNULL;
+  po = s->sym ? px_get (mo) : PNULL;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&s->lock);
+      k = s->next++;
+      pthread_mutex_unlock (&s->lock);
+      if (k >= s->nfreq)
+        break;
+
+      TRACE_BEGIN ("point", s->freq[k]);
+      Omega = 2.0*PI*s->freq[k];
+      if (s->sym)
+        {
+          sym_assemble (s->sym, Omega, Z, Zo);
+          port_factor (Z, pivot);
+          if (s->sym->np > 0)
+            port_factor (Zo, po);
+        }
+      else
+        {
+          calcz (Z, s->L, s->e, s->n0, Omega, s->e0, s->cond, s->N);
+          port_factor (Z, pivot);
+        }
+      X = ZMNULL;
+      if (s->X)
+        {
+          X = s->sym ? sym_solutions (s->sym, Z, pivot, Zo, po, ZMNULL)
+                     : port_solutions (Z, pivot, s->n0, s->cond, s->N, ZMNULL);
+          y = port_sum (X, s->n0, s->cond, s->N, ZMNULL);
+        }
+      else if (s->sym)
+        y = sym_reduce (s->sym, Z, pivot, Zo, po, ZMNULL);
+      else
+        y = port_reduce (Z, pivot, s->n0, s->cond, s->N, ZMNULL);
+      z = port_inverse (y, ZMNULL);
+      TRACE_END ("point");
+
+      pthread_mutex_lock (&s->lock);
+      if (s->X)
+        s->X[k] = X;
+      s->y[k] = y;
+      s->z[k] = z;
+      pthread_cond_broadcast (&s->done);
+      pthread_mutex_unlock (&s->lock);
+    }
+
+  if (po)
+    PX_FREE (po);
+  if (Zo)
+    ZM_FREE (Zo);
+  PX_FREE (pivot);
+  ZM_FREE (Z);
+  prof_attach (NULL);
+  return NULL;
+}
+
+void sweep (const weeks_ctx *ctx, const MAT *L, const symmetry *sym,
+            element *e, element e0, int n0, conductor *cond, int N,
+            const double *freq, int nfreq, int workers, sweep_report report,
+            void *arg)
+{
+  sweep_state s;
+  pthread_t *tid;
+  ZMAT *z, *y, *X;
+  prof *outer;
+  int i, k;
+
+  s.L = L;
+  s.sym = sym;
+  s.e = e;
+  s.e0 = e0;
+  s.n0 = n0;
+  s.N = N;
+  s.cond = cond;
+  s.freq = freq;
+  s.nfreq = nfreq;
+  s.next = 0;
+  s.z = (ZMAT **) Calloc (nfreq, sizeof (ZMAT *));
+  s.y = (ZMAT **) Calloc (nfreq, sizeof (ZMAT *));
+  s.X = ctx->cur ? (ZMAT **) Calloc (nfreq, sizeof (ZMAT *)) : NULL;
+  s.prof = prof_current ();
+  pthread_mutex_init (&s.lock, NULL);
+  pthread_cond_init (&s.done, NULL);
+
+  fprintf (stderr,"\n\nSolving %d frequency point(s) with %d worker(s):\n",
+           nfreq, workers);
+  tid = (pthread_t *) Malloc (workers * sizeof (pthread_t));
+  for (i=0; i<workers; i++)
+    if (pthread_create (&tid[i], NULL, sweep_worker, &s) != 0)
+      {
+        fprintf (stderr, "\nWARNING: Can not start sweep worker %d, going on with %d",
+                 i+1, i);
+        workers = i;
+        break;
+      }
+  /* Without any worker thread the points are solved here */
+  if (workers == 0)
+    {
+      outer = prof_current ();
+      sweep_worker (&s);
+      prof_attach (outer);
+    }
+
+  /* Stream results in frequency order */
+  for (k=0; k<nfreq; k++)
+    {
+      pthread_mutex_lock (&s.lock);
+      while (s.z[k] == ZMNULL)
+        pthread_cond_wait (&s.done, &s.lock);
+      z = s.z[k];
+      s.z[k] = ZMNULL;
+      y = s.y[k];
+      X = s.X ? s.X[k] : ZMNULL;
+      pthread_mutex_unlock (&s.lock);
+      report (z, y, freq[k], N, arg);
+      ZM_FREE (y);
+      if (X)
+        {
+          cur_write (ctx->cur, X, e, e0, n0, cond, N, freq[k]);
+          ZM_FREE (X);
+        }
+    }
+
+  for (i=0; i<workers; i++)
+    pthread_join (tid[i], NULL);
+
+  Free (tid);
+  Free (s.z);
+  Free (s.y);
+  if (s.X)
+    Free (s.X);
+  pthread_mutex_destroy (&s.lock);
+  pthread_cond_destroy (&s.done);
+}
+
+/* Fill and sweep one mesh, split into its even and odd halves when it
+ * is mirror symmetric and ctx->symmetry is on. The fill comes from
+ * ctx->lpc when the context has an Lp cache, possibly as a read-only
+ * mapping of its cache directory.
+ */
+void sweep_mesh (const weeks_ctx *ctx, element *e, element e0, int M, int n0,
+                 conductor *cond, int N, const double *freq, int nfreq,
+                 sweep_report report, void *arg)
+{
+  symmetry *sym;
+  MAT *L;
+  int workers, ne, no;
+
+  sym = ctx->symmetry ? find_symmetry (e, e0, M, n0, cond, N) : NULL;
+  if (sym != NULL)
+    {
+      if (ctx->lpc)
+        lpc_sym (ctx->lpc, sym);
+      else
+        sym_fill (sym);
+      ne = sym->np+sym->ns;
+      no = sym->np;
+      workers = sweep_workers ((double) ne*ne*sizeof (Real)
+                               + (double) no*no*sizeof (Real),
+                               (double) (ne*ne+no*no)*sizeof (complex),
+                               nfreq, ctx->threads, ctx->memory_budget);
+      sweep (ctx, MNULL, sym, e, e0, n0, cond, N, freq, nfreq, workers,
+             report, arg);
+      if (ctx->lpc)
+        {
+          lpc_release (ctx->lpc, sym->Le);
+          lpc_release (ctx->lpc, sym->Lo);
+          sym->Le = sym->Lo = MNULL;
+        }
+      sym_free (sym);
+      return;
+    }
+
+  if (ctx->lpc)
+    L = lpc_full (ctx->lpc, e, e0, M);
+  else
+    {
+      L = m_get (M, M);
+      calclp (L, e, e0);
+    }
+  workers = sweep_workers (sweep_shared (M), sweep_per_worker (M), nfreq,
+                           ctx->threads, ctx->memory_budget);
+  sweep (ctx, L, NULL, e, e0, n0, cond, N, freq, nfreq, workers, report,
+         arg);
+  lpc_release (ctx->lpc, L);
+}
@@ -0,0 +1,422 @@
+/* symmetry.c - even/odd decomposition of mirror symmetric cross-sections
+ *
+ * If the mesh is its own mirror image about the vertical axis through
+ * the centre of the ground plane (and e0 lies on that axis), or through
+ * the centre of the signal conductors over an ideal ground, the element
+ * matrix commutes with the mirror permutation. In the basis
+ *
+ *   even: (e_a + e_b)/sqrt(2) for each mirror pair (a,b), e_s on the axis
+ *   odd:  (e_a - e_b)/sqrt(2) for each mirror pair
+ *
+ * it splits into an even block of np+ns and an odd block of np unknowns:
+ *
+ *   Ze[p][q] = Z[a][c] + Z[a][d]      Zo[p][q] = Z[a][c] - Z[a][d]
+ *   Ze[p][s] = sqrt(2) Z[a][s]        Ze[s][t] = Z[s][t]
+ *
+ * for pairs p = (a,b), q = (c,d). The two blocks are factored on their
+ * own (about a quarter of the work of the full matrix) and the port
+ * admittance is y = Ue' Ze^-1 Ue + Uo' Zo^-1 Uo, where the columns of
+ * Ue and Uo are the conductor indicator vectors in the two bases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "zmatrix2.h"
+#include "weeks.h"
+#include "calcl.h"
+#include "reduce.h"
+#include "symmetry.h"
+#include "prof.h"
+#include "mf.h"
+
+#define SYM_TOL 1e-9   /* matching tolerance relative to the ground width */
+
+/* Every key carries the matching tolerance, so that the comparison
+ * needs no shared state and concurrent runs can sort at the same time.
+ */
+typedef struct {
+  double y1, x1, eps;
+  int i;
+} sym_key;
+
+static int key_cmp (const void *p, const void *q)
+{
+  const sym_key *u = (const sym_key *) p, *v = (const sym_key *) q;
+
+  if (u->y1 < v->y1-u->eps)
+    return -1;
+  if (u->y1 > v->y1+u->eps)
+    return 1;
+  if (u->x1 < v->x1-u->eps)
+    return -1;
+  if (u->x1 > v->x1+u->eps)
+    return 1;
+  return 0;
+}
+
+/* Element that is the mirror image of e[i], or -1 */
+static int mirror_of (const element *e, const sym_key *keys, int M,
+                      double axis, double sym_eps, int i)
+{
+  sym_key k, *hit;
+  int j;
+
+  k.y1 = e[i].y1;
+  k.x1 = 2.0*axis-e[i].x2;
+  k.eps = sym_eps;
+  hit = (sym_key *) bsearch (&k, keys, M, sizeof (sym_key), key_cmp);
+  if (hit == NULL)
+    return -1;
+  j = hit->i;
+  if (fabs (e[j].x2-(2.0*axis-e[i].x1)) > sym_eps ||
+      fabs (e[j].y2-e[i].y2) > sym_eps)
+    return -1;
+  return j;
+}
+
+/* Conductor (0..N-1) of signal element i, -1 for the ground plane */
+static int owner (int i, int n0, conductor *test, int N)
+{
+  int k;
+
+  if (i < n0)
+    return -1;
+  i -= n0;
+  for (k=0;k<N;k++)
+    {
+      if (i < test[k+1].n)
+        return k;
+      i -= test[k+1].n;
+    }
+  return -1;
+}
+
+/* Detect mirror symmetry of the mesh. Returns NULL if there is none. */
+symmetry *find_symmetry (element *e, element e0, int M, int n0,
+                         conductor *test, int N)
+{
+  symmetry *sym;
+  sym_key *keys;
+  int *image;
+  int i, j, p, t, k, oa, ob;
+  double axis, r2, xl, xr, sym_eps;
+
+  axis = test[0].x+0.5*test[0].w;
+  sym_eps = SYM_TOL*test[0].w;
+  if (IMAGE_GROUND (e0))
+    {
+      /* an infinite ground is symmetric about any vertical axis */
+      xl = test[1].x;
+      xr = test[1].x+test[1].w;
+      for (k=2;k<=N;k++)
+        {
+          xl = fmin (xl, test[k].x);
+          xr = fmax (xr, test[k].x+test[k].w);
+        }
+      axis = 0.5*(xl+xr);
+    }
+  else if (fabs (e0.x1+e0.x2-2.0*axis) > sym_eps)
+    return NULL;
+
+  keys = (sym_key *) Malloc (M*sizeof (sym_key));
+  for (i=0;i<M;i++)
+    {
+      keys[i].y1 = e[i].y1;
+      keys[i].x1 = e[i].x1;
+      keys[i].eps = sym_eps;
+      keys[i].i = i;
+    }
+  qsort (keys, M, sizeof (sym_key), key_cmp);
+
+  image = (int *) Malloc (M*sizeof (int));
+  for (i=0;i<M;i++)
+    {
+      image[i] = mirror_of (e, keys, M, axis, sym_eps, i);
+      /* a ground element must map to a ground element */
+      if (image[i] < 0 || (i < n0) != (image[i] < n0))
+        break;
+    }
+  Free (keys);
+  if (i < M)
+    {
+      Free (image);
+      return NULL;
+    }
+
+  sym = (symmetry *) Calloc (1, sizeof (symmetry));
+  sym->axis = axis;
+  sym->e = e;
+  sym->e0 = e0;
+  sym->n0 = n0;
+  sym->N = N;
+  sym->cond = test;
+  for (i=0;i<M;i++)
+    {
+      if (image[i] > i)
+        sym->np++;
+      else if (image[i] == i)
+        sym->ns++;
+    }
+  sym->a = (int *) Malloc ((sym->np+1)*sizeof (int));
+  sym->b = (int *) Malloc ((sym->np+1)*sizeof (int));
+  sym->s = (int *) Malloc ((sym->ns+1)*sizeof (int));
+  p = t = 0;
+  for (i=0;i<M;i++)
+    {
+      if (image[i] > i)
+        {
+          sym->a[p] = i;
+          sym->b[p++] = image[i];
+        }
+      else if (image[i] == i)
+        sym->s[t++] = i;
+    }
+  Free (image);
+
+  /* Conductor indicator vectors in the even and odd bases */
+  r2 = 1.0/sqrt (2.0);
+  sym->Ue = m_get (sym->np+sym->ns, N);
+  sym->Uo = m_get (sym->np > 0 ? sym->np : 1, N);
+  for (p=0;p<sym->np;p++)
+    {
+      oa = owner (sym->a[p], n0, test, N);
+      ob = owner (sym->b[p], n0, test, N);
+      for (k=0;k<N;k++)
+        {
+          sym->Ue->me[p][k] = r2*((oa == k)+(ob == k));
+          sym->Uo->me[p][k] = r2*((oa == k)-(ob == k));
+        }
+    }
+  for (t=0;t<sym->ns;t++)
+    {
+      j = owner (sym->s[t], n0, test, N);
+      for (k=0;k<N;k++)
+        sym->Ue->me[sym->np+t][k] = j == k;
+    }
+
+  fprintf (stderr, "\nMirror symmetry about x=%.4e: %d pairs, %d on the axis",
+           axis, sym->np, sym->ns);
+  return sym;
+}
+
+/* Fill the even and odd partial inductance matrices. Needs about half
+ * of the lp() calls of calclp.
+ */
+void sym_fill (symmetry *sym)
+{
+  element *e = sym->e;
+  element e0 = sym->e0;
+  int np = sym->np, ns = sym->ns;
+  int M, i, p, q, t, u, a, c, d;
+  double lmm, lac, lad, r2;
+  VEC *li0, *l0j;
+  uint64_t t0;
+
+  t0 = prof_begin ();
+  r2 = sqrt (2.0);
+  M = 2*np+ns;
+  li0 = v_get (M);
+  l0j = v_get (M);
+  if (!IMAGE_GROUND (e0))
+    {
+      lmm = lp (&e0, &e0);
+      for (i=0;i<M;i++)
+        {
+          li0->ve[i] = lmm-lp (&e[i], &e0);
+          l0j->ve[i] = lp (&e0, &e[i]);
+        }
+    }
+
+#define LF(i,j) (IMAGE_GROUND (e0) ? lp_image (&e[i], &e[j], e0) : \
+                 li0->ve[i]-l0j->ve[j]+lp (&e[i], &e[j]))
+
+  sym->Le = m_get (np+ns, np+ns);
+  sym->Lo = m_get (np > 0 ? np : 1, np > 0 ? np : 1);
+  for (p=0;p<np;p++)
+    {
+      a = sym->a[p];
+      for (q=0;q<=p;q++)
+        {
+          c = sym->a[q];
+          d = sym->b[q];
+          lac = LF (a, c);
+          lad = LF (a, d);
+          sym->Le->me[p][q] = sym->Le->me[q][p] = lac+lad;
+          sym->Lo->me[p][q] = sym->Lo->me[q][p] = lac-lad;
+        }
+      for (t=0;t<ns;t++)
+        sym->Le->me[p][np+t] = sym->Le->me[np+t][p] = r2*LF (a, sym->s[t]);
+    }
+  for (t=0;t<ns;t++)
+    for (u=0;u<=t;u++)
+      sym->Le->me[np+t][np+u] = sym->Le->me[np+u][np+t] =
+        LF (sym->s[t], sym->s[u]);
+
+#undef LF
+
+  V_FREE (li0);
+  V_FREE (l0j);
+  prof_add (PROF_FILL, t0);
+}
+
+/* Resistance on the diagonal for element i */
+static double diag_loss (const symmetry *sym, int i, double Omega)
+{
+  if (i < sym->n0)
+    return 0.0;
+  return calc_element_loss (&sym->e[i], Omega, sym->cond, sym->N);
+}
+
+/* Assemble the even and odd blocks of Z = R + jwL at Omega */
+void sym_assemble (const symmetry *sym, double Omega, ZMAT *Ze, ZMAT *Zo)
+{
+  int np = sym->np, ns = sym->ns;
+  int i, j;
+  double r00, r2;
+  uint64_t t;
+
+  t = prof_begin ();
+  r2 = sqrt (2.0);
+  r00 = calc_r00 (sym->e0, Omega, sym->cond);
+  for (i=0;i<np+ns;i++)
+    for (j=0;j<np+ns;j++)
+      {
+        Ze->me[i][j].im = Omega*sym->Le->me[i][j];
+        if (i < np && j < np)
+          Ze->me[i][j].re = 2.0*r00;
+        else if (i < np || j < np)
+          Ze->me[i][j].re = r2*r00;
+        else
+          Ze->me[i][j].re = r00;
+      }
+  for (i=0;i<np;i++)
+    for (j=0;j<np;j++)
+      {
+        Zo->me[i][j].im = Omega*sym->Lo->me[i][j];
+        Zo->me[i][j].re = 0.0;
+      }
+
+  for (i=0;i<np;i++)
+    {
+      Ze->me[i][i].re += diag_loss (sym, sym->a[i], Omega);
+      Zo->me[i][i].re += diag_loss (sym, sym->a[i], Omega);
+    }
+  for (i=0;i<ns;i++)
+    Ze->me[np+i][np+i].re += diag_loss (sym, sym->s[i], Omega);
+  prof_add (PROF_ASSEMBLE, t);
+}
+
+/* Add U' Z^-1 U to y for one factored block */
+static void block_reduce (const MAT *U, ZMAT *LU, PERM *pivot, ZMAT *y)
+{
+  ZVEC *b, *x;
+  int i, j, k;
+  uint64_t t;
+
+  t = prof_begin ();
+  b = zv_get (LU->m);
+  x = zv_get (LU->m);
+  for (k=0;k<U->n;k++)
+    {
+      for (j=0;j<LU->m;j++)
+        {
+          b->ve[j].re = U->me[j][k];
+          b->ve[j].im = 0.0;
+        }
+      zzLUsolve (LU, pivot, b, x);
+      for (i=0;i<U->n;i++)
+        for (j=0;j<LU->m;j++)
+          {
+            y->me[i][k].re += U->me[j][i]*x->ve[j].re;
+            y->me[i][k].im += U->me[j][i]*x->ve[j].im;
+          }
+    }
+  ZV_FREE (b);
+  ZV_FREE (x);
+  prof_count (PROF_FLOPS, PROF_SOLVE_FLOPS (LU->m, U->n));
+  prof_add (PROF_SOLVE, t);
+}
+
+/* Port admittance from the factored even and odd blocks */
+ZMAT *sym_reduce (const symmetry *sym, ZMAT *Ze, PERM *pe, ZMAT *Zo,
+                  PERM *po, ZMAT *y)
+{
+  y = zm_resize (y, sym->N, sym->N);
+  zm_zero (y);
+  block_reduce (sym->Ue, Ze, pe, y);
+  if (sym->np > 0)
+    block_reduce (sym->Uo, Zo, po, y);
+  return y;
+}
+
+/* Element currents of the N port solutions from the factored even and
+ * odd blocks, in the element order of the full mesh (M x N, as
+ * port_solutions). Costs the same solves as sym_reduce.
+ */
+ZMAT *sym_solutions (const symmetry *sym, ZMAT *Ze, PERM *pe, ZMAT *Zo,
+                     PERM *po, ZMAT *X)
+{
+  ZVEC *b, *xe, *xo;
+  int j, k, p, np;
+  double r2;
+  uint64_t t;
+
+  t = prof_begin ();
+  np = sym->np;
+  r2 = 1.0/sqrt (2.0);
+  X = zm_resize (X, 2*np+sym->ns, sym->N);
+  b = zv_get (Ze->m);
+  xe = zv_get (Ze->m);
+  xo = zv_get (np > 0 ? np : 1);
+  for (k=0;k<sym->N;k++)
+    {
+      for (j=0;j<Ze->m;j++)
+        {
+          b->ve[j].re = sym->Ue->me[j][k];
+          b->ve[j].im = 0.0;
+        }
+      zzLUsolve (Ze, pe, b, xe);
+      if (np > 0)
+        {
+          b = zv_resize (b, np);
+          for (j=0;j<np;j++)
+            {
+              b->ve[j].re = sym->Uo->me[j][k];
+              b->ve[j].im = 0.0;
+            }
+          zzLUsolve (Zo, po, b, xo);
+          b = zv_resize (b, Ze->m);
+        }
+      for (p=0;p<np;p++)
+        {
+          X->me[sym->a[p]][k].re = r2*(xe->ve[p].re+xo->ve[p].re);
+          X->me[sym->a[p]][k].im = r2*(xe->ve[p].im+xo->ve[p].im);
+          X->me[sym->b[p]][k].re = r2*(xe->ve[p].re-xo->ve[p].re);
+          X->me[sym->b[p]][k].im = r2*(xe->ve[p].im-xo->ve[p].im);
+        }
+      for (j=0;j<sym->ns;j++)
+        X->me[sym->s[j]][k] = xe->ve[np+j];
+    }
+  ZV_FREE (b);
+  ZV_FREE (xe);
+  ZV_FREE (xo);
+  prof_count (PROF_FLOPS, PROF_SOLVE_FLOPS (Ze->m, sym->N)
+                          +PROF_SOLVE_FLOPS (np, sym->N));
+  prof_add (PROF_SOLVE, t);
+  return X;
+}
+
+void sym_free (symmetry *sym)
+{
+  if (sym == NULL)
+    return;
+  M_FREE (sym->Le);
+  M_FREE (sym->Lo);
+  M_FREE (sym->Ue);
+  M_FREE (sym->Uo);
+  Free (sym->a);
+  Free (sym->b);
+  Free (sym->s);
+  Free (sym);
+}
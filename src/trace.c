@@ -0,0 +1,240 @@
+/* trace.c - timeline of phases and tasks per thread (Chrome trace)
+ *
+ * Between trace_start and trace_stop every thread that records an event
+ * gets a buffer of its own, a list of fixed size chunks that only that
+ * thread appends to. The buffers are pushed on a global list with a
+ * compare and swap when they are made, so recording takes no lock. The
+ * buffers outlive their threads; trace_stop, which must be called when
+ * no other thread records any more (after the workers are joined),
+ * writes all of them as a Chrome Trace Event file for Perfetto or
+ * chrome://tracing and frees them:
+ *
+ *   {"traceEvents":[
+ *     {"name":"thread_name","ph":"M","pid":..,"tid":..,"args":{"name":..}},
+ *     {"name":"fill","cat":"phase","ph":"X","pid":..,"tid":..,
+ *      "ts":..,"dur":..},
+ *     {"name":"point","cat":"task","ph":"B","pid":..,"tid":..,"ts":..,
+ *      "args":{"value":..}}, ...
+ *   ],"displayTimeUnit":"ms"}
+ *
+ * Times are microseconds from trace_start. The phases of prof.c come as
+ * complete events, the tasks of the TRACE_BEGIN/TRACE_END pairs
+ * (frequency and study points, out-of-core panels, Monte Carlo samples,
+ * batch decks and server jobs) as begin and end events with the
+ * frequency or the number of the point, panel, sample, deck or job as
+ * their value.
+ *
+ * Without WEEKS_TRACE only trace_start and trace_stop are left, so a
+ * driver can say that tracing was not built in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "trace.h"
+#include "prof.h"
+#include "mf.h"
+
+#ifdef WEEKS_TRACE
+
+#define TRACE_CHUNK 4096
+
+typedef struct {
+  const char *name;
+  uint64_t ts, dur;
+  double value;
+  char ph;
+} trace_rec;
+
+typedef struct trace_chunk {
+  struct trace_chunk *next;
+  int n;
+  trace_rec rec[TRACE_CHUNK];
+} trace_chunk;
+
+typedef struct trace_buf {
+  struct trace_buf *next;
+  const char *name;             /* thread name or NULL */
+  int tid;
+  trace_chunk *head, *tail;
+} trace_buf;
+
+static char file[256];
+static int on;                  /* recording */
+static unsigned gen;            /* trace_start calls so far */
+static int ntid;
+static uint64_t t0;
+static trace_buf *bufs;
+
+static __thread trace_buf *mine;
+static __thread unsigned mine_gen;
+
+int trace_start (const char *name)
+{
+  if (__atomic_load_n (&on, __ATOMIC_ACQUIRE))
+    {
+      fprintf (stderr, "\nERROR: a trace to '%s' is already running", file);
+      return 0;
+    }
+  strncpy (file, name, sizeof (file)-1);
+  t0 = prof_now ();
+  ntid = 0;
+  bufs = NULL;
+  gen++;
+  __atomic_store_n (&on, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* This thread's buffer, made on its first event of the trace */
+static trace_buf *buffer (void)
+{
+  trace_buf *b;
+
+  if (mine != NULL && mine_gen == gen)
+    return mine;
+  b = (trace_buf *) Calloc (1, sizeof (trace_buf));
+  b->tid = __atomic_add_fetch (&ntid, 1, __ATOMIC_RELAXED);
+  b->head = b->tail = (trace_chunk *) Calloc (1, sizeof (trace_chunk));
+  b->next = __atomic_load_n (&bufs, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n (&bufs, &b->next, b, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  mine = b;
+  mine_gen = gen;
+  return b;
+}
+
+static void record (char ph, const char *name, uint64_t ts, uint64_t dur,
+                    double value)
+{
+  trace_buf *b;
+  trace_chunk *c;
+  trace_rec *r;
+
+  b = buffer ();
+  c = b->tail;
+  if (c->n == TRACE_CHUNK)
+    {
+      c = (trace_chunk *) Calloc (1, sizeof (trace_chunk));
+      b->tail->next = c;
+      b->tail = c;
+    }
+  r = &c->rec[c->n++];
+  r->name = name;
+  r->ph = ph;
+  r->ts = ts;
+  r->dur = dur;
+  r->value = value;
+}
+
+/* Begin ('B') or end ('E') of a task of this thread now. name must be
+ * a string constant.
+ */
+void trace_event (char ph, const char *name, double value)
+{
+  if (!__atomic_load_n (&on, __ATOMIC_RELAXED))
+    return;
+  record (ph, name, prof_now (), 0, value);
+}
+
+/* A phase of this thread from ta to tb (prof_now) */
+void trace_complete (const char *name, uint64_t ta, uint64_t tb)
+{
+  if (!__atomic_load_n (&on, __ATOMIC_RELAXED))
+    return;
+  record ('X', name, ta, tb-ta, 0.0);
+}
+
+/* Name this thread on the timeline */
+void trace_thread (const char *name)
+{
+  if (!__atomic_load_n (&on, __ATOMIC_RELAXED))
+    return;
+  buffer ()->name = name;
+}
+
+static double us (uint64_t t)
+{
+  return 1e-3*(double) (t-t0);
+}
+
+/* Write the trace and free its buffers. Returns 0 if it can not be
+ * written.
+ */
+int trace_stop (void)
+{
+  trace_buf *b, *nb;
+  trace_chunk *c, *nc;
+  trace_rec *r;
+  FILE *fp;
+  int i, first, pid, ok;
+
+  if (!__atomic_load_n (&on, __ATOMIC_ACQUIRE))
+    return 1;
+  __atomic_store_n (&on, 0, __ATOMIC_RELEASE);
+
+  ok = 1;
+  if ((fp = fopen (file, "w")) == NULL)
+    {
+      fprintf (stderr, "\nERROR: Can not write trace file '%s'", file);
+      ok = 0;
+    }
+  pid = (int) getpid ();
+  first = 1;
+  if (fp)
+    fprintf (fp, "{\"traceEvents\":[");
+  for (b=bufs;b;b=nb)
+    {
+      nb = b->next;
+      if (fp)
+        {
+          fprintf (fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                   first ? "" : ",", pid, b->tid,
+                   b->name ? b->name : "thread", b->tid);
+          first = 0;
+        }
+      for (c=b->head;c;c=nc)
+        {
+          nc = c->next;
+          for (i=0;fp && i<c->n;i++)
+            {
+              r = &c->rec[i];
+              fprintf (fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+                       r->name, r->ph == 'X' ? "phase" : "task", r->ph, pid,
+                       b->tid, us (r->ts));
+              if (r->ph == 'X')
+                fprintf (fp, ",\"dur\":%.3f", 1e-3*(double) r->dur);
+              else if (r->ph == 'B')
+                fprintf (fp, ",\"args\":{\"value\":%.6g}", r->value);
+              fputc ('}', fp);
+            }
+          Free (c);
+        }
+      Free (b);
+    }
+  bufs = NULL;
+  if (fp)
+    {
+      fprintf (fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+      ok = fclose (fp) == 0;
+    }
+  return ok;
+}
+
+#else
+
+int trace_start (const char *name)
+{
+  fprintf (stderr, "\nERROR: %s: tracing is not built in (make TRACE=1)",
+           name);
+  return 0;
+}
+
+int trace_stop (void)
+{
+  return 1;
+}
+
+#endif
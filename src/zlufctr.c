@@ -50,15 +50,14 @@ PERM	*pivot;
 	int	i_max;
 	Real	dtemp, max1;
 	complex	**A_v, *A_piv, *A_row, temp;
-	static	VEC	*scale = VNULL;
+	VEC	*scale;	/* not static: sweep workers factor concurrently */
 
 	if ( A==ZMNULL || pivot==PNULL )
 		error(E_NULL,"zLUfactor");
 	if ( pivot->size != A->m )
 		error(E_SIZES,"zLUfactor");
 	m = A->m;	n = A->n;
-	scale = v_resize(scale,A->m);
-	MEM_STAT_REG(scale,TYPE_VEC);
+	scale = v_get(A->m);
 	A_v = A->me;
 
 	/* initialise pivot with identity permutation */
@@ -125,6 +124,7 @@ PERM	*pivot;
 	    }
 	}
 
+	V_FREE(scale);
 	return A;
 }
 
@@ -210,7 +210,7 @@ double	zLUcondest(LU,pivot)
 ZMAT	*LU;
 PERM	*pivot;
 {
-    static	ZVEC	*y = ZVNULL, *z = ZVNULL;
+    ZVEC	*y, *z;
     Real	cond_est, L_norm, U_norm, norm, sn_inv;
     complex	sum;
     int		i, j, n;
@@ -223,10 +223,8 @@ PERM	*pivot;
 	error(E_SIZES,"zLUcondest");
 
     n = LU->n;
-    y = zv_resize(y,n);
-    z = zv_resize(z,n);
-    MEM_STAT_REG(y,TYPE_ZVEC);
-    MEM_STAT_REG(z,TYPE_ZVEC);
+    y = zv_get(n);
+    z = zv_get(n);
 
     cond_est = 0.0;		/* should never be returned */
 
@@ -242,7 +240,10 @@ PERM	*pivot;
 	sum.re += sum.re * sn_inv;
 	sum.im += sum.im * sn_inv;
 	if ( is_zero(LU->me[i][i]) )
+	{
+	    ZV_FREE(y);	ZV_FREE(z);
 	    return HUGE;
+	}
 	/* y->ve[i] = sum / LU->me[i][i]; */
 	y->ve[i] = zdiv(sum,LU->me[i][i]);
     }
@@ -273,6 +274,7 @@ PERM	*pivot;
 
     tracecatch(cond_est = U_norm*L_norm*zv_norm_inf(z)/zv_norm_inf(y),
 	       "LUcondest");
+    ZV_FREE(y);	ZV_FREE(z);
 
     return cond_est;
 }